@@ -122,6 +122,8 @@ public:
 	typedef Eigen::Matrix<scalar_type, m, n> processMatrix1(state &, const input &);
 	typedef Eigen::Matrix<scalar_type, m, process_noise_dof> processMatrix2(state &, const input &);
 	typedef Eigen::Matrix<scalar_type, process_noise_dof, process_noise_dof> processnoisecovariance;
+	typedef void processMatrix1Mul(const cov &, cov &);
+	typedef void processMatrix2Cov(const Matrix<scalar_type, n, process_noise_dof> &, const processnoisecovariance &, cov &);
 	typedef measurement measurementModel(state &, bool &);
 	typedef measurement measurementModel_share(state &, share_datastruct<state, measurement, measurement_noise_dof> &);
 	typedef Eigen::Matrix<scalar_type, Eigen::Dynamic, 1> measurementModel_dyn(state &, bool &);
@@ -275,6 +277,14 @@ public:
 		x_.build_vect_state();
 	}
 
+	//receive system-specific products with the discrete transition (M = F * M) and the discrete noise Jacobian (P += G * Q * G^T)
+	//that exploit the sparsity of F and G, used by predict() in place of the dense products.
+	void init_sparse_propagation(processMatrix1Mul f_x_mul_in, processMatrix2Cov f_w_cov_in)
+	{
+		f_x_mul = f_x_mul_in;
+		f_w_cov = f_w_cov_in;
+	}
+
 	// iterated error state EKF propogation
 	void predict(double &dt, processnoisecovariance &Q, const input &i_in){
 		flatted_state f_ = f(x_, i_in);
@@ -378,7 +388,17 @@ public:
 		P_ = xp * P_ * xp.transpose() + (f_w1 * dt) * Q * (f_w1 * dt).transpose();
 	#else
 		F_x1 += f_x_final * dt;
-		P_ = (F_x1) * P_ * (F_x1).transpose() + (dt * f_w_final) * Q * (dt * f_w_final).transpose();
+		if(f_x_mul && f_w_cov)
+		{
+			f_x_mul(F_x1, P_);
+			P_.transposeInPlace();
+			f_x_mul(F_x1, P_);
+			f_w_cov(dt * f_w_final, Q, P_);
+		}
+		else
+		{
+			P_ = (F_x1) * P_ * (F_x1).transpose() + (dt * f_w_final) * Q * (dt * f_w_final).transpose();
+		}
 	#endif
 	}
 
@@ -1930,6 +1950,185 @@ public:
 		}
 	}
 
+	//iterated error state EKF update modified for one specific system, with the measurement depending only on the first
+	//dof_h dimensions of the state. Works on fixed-size matrices only: H^T H and H^T h are accumulated as dof_h x dof_h and
+	//dof_h x 1, and the gain is obtained from one LDLT solve of the symmetric dof_h x dof_h system
+	//(R P11 + P11 H^T H P11) Y = P11 [H^T H, H^T h], where P11 is the leading dof_h block of P_, so K = P_(:, 0:dof_h) Y.
+	template<int dof_h>
+	void update_iterated_dyn_share_fixed(double R, double &solve_time) {
+		static_assert(dof_h <= n, "measurement dimension exceeds state dimension");
+
+		dyn_share_datastruct<scalar_type> dyn_share;
+		dyn_share.valid = true;
+		dyn_share.converge = true;
+		int t = 0;
+		state x_propagated = x_;
+		cov P_propagated = P_;
+		int dof_Measurement;
+
+		Matrix<scalar_type, n, 1> K_h;
+		Matrix<scalar_type, n, n> K_x;
+		Matrix<scalar_type, dof_h, dof_h> HTH;
+		Matrix<scalar_type, dof_h, 1> HTz;
+		Matrix<scalar_type, dof_h, dof_h> P11;
+		Matrix<scalar_type, dof_h, dof_h + 1> rhs;
+		Matrix<scalar_type, dof_h, dof_h + 1> Y;
+		LDLT<Matrix<scalar_type, dof_h, dof_h> > ldlt;
+
+		vectorized_state dx_new = vectorized_state::Zero();
+		iter_num_ = 0;
+		dx_first_norm_ = 0;
+		dx_rate_ = 0;
+		for(int i=-1; i<maximum_iter; i++)
+		{
+			dyn_share.valid = true;	
+			h_dyn_share(x_, dyn_share);
+
+			if(! dyn_share.valid)
+			{
+				continue; 
+			}
+			iter_num_++;
+
+			double solve_start = omp_get_wtime();
+			dof_Measurement = dyn_share.h_x.rows();
+			vectorized_state dx;
+			x_.boxminus(dx, x_propagated);
+			dx_new = dx;
+
+			P_ = P_propagated;
+
+			Matrix<scalar_type, 3, 3> res_temp_SO3;
+			MTK::vect<3, scalar_type> seg_SO3;
+			for (std::vector<std::pair<int, int> >::iterator it = x_.SO3_state.begin(); it != x_.SO3_state.end(); it++) {
+				int idx = (*it).first;
+				for(int i = 0; i < 3; i++){
+					seg_SO3(i) = dx(idx+i);
+				}
+
+				res_temp_SO3 = MTK::A_matrix(seg_SO3).transpose();
+				dx_new.template block<3, 1>(idx, 0) = res_temp_SO3 * dx_new.template block<3, 1>(idx, 0);
+				for(int i = 0; i < n; i++){
+					P_. template block<3, 1>(idx, i) = res_temp_SO3 * (P_. template block<3, 1>(idx, i));	
+				}
+				for(int i = 0; i < n; i++){
+					P_. template block<1, 3>(i, idx) =(P_. template block<1, 3>(i, idx)) *  res_temp_SO3.transpose();	
+				}
+			}
+
+			Matrix<scalar_type, 2, 2> res_temp_S2;
+			MTK::vect<2, scalar_type> seg_S2;
+			for (std::vector<std::pair<int, int> >::iterator it = x_.S2_state.begin(); it != x_.S2_state.end(); it++) {
+				int idx = (*it).first;
+				for(int i = 0; i < 2; i++){
+					seg_S2(i) = dx(idx + i);
+				}
+
+				Eigen::Matrix<scalar_type, 2, 3> Nx;
+				Eigen::Matrix<scalar_type, 3, 2> Mx;
+				x_.S2_Nx_yy(Nx, idx);
+				x_propagated.S2_Mx(Mx, seg_S2, idx);
+				res_temp_S2 = Nx * Mx; 
+				dx_new.template block<2, 1>(idx, 0) = res_temp_S2 * dx_new.template block<2, 1>(idx, 0);
+				for(int i = 0; i < n; i++){
+					P_. template block<2, 1>(idx, i) = res_temp_S2 * (P_. template block<2, 1>(idx, i));	
+				}
+				for(int i = 0; i < n; i++){
+					P_. template block<1, 2>(i, idx) = (P_. template block<1, 2>(i, idx)) * res_temp_S2.transpose();
+				}
+			}
+
+			HTH.setZero();
+			HTz.setZero();
+			for(int j = 0; j < dof_Measurement; j++)
+			{
+				Matrix<scalar_type, dof_h, 1> h_j = dyn_share.h_x.row(j).template head<dof_h>().transpose();
+				HTH.noalias() += h_j * h_j.transpose();
+				HTz.noalias() += h_j * dyn_share.h(j);
+			}
+
+			P11 = P_. template block<dof_h, dof_h>(0, 0);
+			rhs. template leftCols<dof_h>().noalias() = P11 * HTH;
+			rhs. template rightCols<1>().noalias() = P11 * HTz;
+			ldlt.compute(R * P11 + rhs. template leftCols<dof_h>() * P11);
+			Y = ldlt.solve(rhs);
+
+			K_h.noalias() = P_. template block<n, dof_h>(0, 0) * Y. template rightCols<1>();
+			K_x.setZero();
+			K_x. template block<n, dof_h>(0, 0).noalias() = P_. template block<n, dof_h>(0, 0) * Y. template leftCols<dof_h>();
+
+			Matrix<scalar_type, n, 1> dx_ = K_h + (K_x - Matrix<scalar_type, n, n>::Identity()) * dx_new; 
+			x_.boxplus(dx_);
+			if(iter_num_ == 1) dx_first_norm_ = dx_.norm();
+			else if(dx_first_norm_ > 0) dx_rate_ = std::pow(dx_.norm() / dx_first_norm_, scalar_type(1) / (iter_num_ - 1));
+			dyn_share.converge = true;
+			for(int i = 0; i < n ; i++)
+			{
+				if(std::fabs(dx_[i]) > limit[i])
+				{
+					dyn_share.converge = false;
+					break;
+				}
+			}
+			if(dyn_share.converge) t++;
+			
+			if(!t && i == maximum_iter - 2)
+			{
+				dyn_share.converge = true;
+			}
+
+			if(t > 1 || i == maximum_iter - 1)
+			{
+				L_ = P_;
+				for(typename std::vector<std::pair<int, int> >::iterator it = x_.SO3_state.begin(); it != x_.SO3_state.end(); it++) {
+					int idx = (*it).first;
+					for(int i = 0; i < 3; i++){
+						seg_SO3(i) = dx_(i + idx);
+					}
+					res_temp_SO3 = MTK::A_matrix(seg_SO3).transpose();
+					for(int i = 0; i < n; i++){
+						L_. template block<3, 1>(idx, i) = res_temp_SO3 * (P_. template block<3, 1>(idx, i)); 
+					}
+					for(int i = 0; i < dof_h; i++){
+						K_x. template block<3, 1>(idx, i) = res_temp_SO3 * (K_x. template block<3, 1>(idx, i));
+					}
+					for(int i = 0; i < n; i++){
+						L_. template block<1, 3>(i, idx) = (L_. template block<1, 3>(i, idx)) * res_temp_SO3.transpose();
+						P_. template block<1, 3>(i, idx) = (P_. template block<1, 3>(i, idx)) * res_temp_SO3.transpose();
+					}
+				}
+
+				for(typename std::vector<std::pair<int, int> >::iterator it = x_.S2_state.begin(); it != x_.S2_state.end(); it++) {
+					int idx = (*it).first;
+					for(int i = 0; i < 2; i++){
+						seg_S2(i) = dx_(i + idx);
+					}
+
+					Eigen::Matrix<scalar_type, 2, 3> Nx;
+					Eigen::Matrix<scalar_type, 3, 2> Mx;
+					x_.S2_Nx_yy(Nx, idx);
+					x_propagated.S2_Mx(Mx, seg_S2, idx);
+					res_temp_S2 = Nx * Mx; 
+					for(int i = 0; i < n; i++){
+						L_. template block<2, 1>(idx, i) = res_temp_S2 * (P_. template block<2, 1>(idx, i)); 
+					}
+					for(int i = 0; i < dof_h; i++){
+						K_x. template block<2, 1>(idx, i) = res_temp_S2 * (K_x. template block<2, 1>(idx, i));
+					}
+					for(int i = 0; i < n; i++){
+						L_. template block<1, 2>(i, idx) = (L_. template block<1, 2>(i, idx)) * res_temp_S2.transpose();
+						P_. template block<1, 2>(i, idx) = (P_. template block<1, 2>(i, idx)) * res_temp_S2.transpose();
+					}
+				}
+
+				P_ = L_ - K_x.template block<n, dof_h>(0, 0) * P_.template block<dof_h, n>(0, 0);
+				solve_time += omp_get_wtime() - solve_start;
+				return;
+			}
+			solve_time += omp_get_wtime() - solve_start;
+		}
+	}
+
 	void change_x(state &input_state)
 	{
 		x_ = input_state;
@@ -1952,6 +2151,23 @@ public:
 	const cov& get_P() const {
 		return P_;
 	}
+
+	void change_max_iter(int maximum_iteration)
+	{
+		maximum_iter = maximum_iteration;
+	}
+
+	//statistics of the last update_iterated_dyn_share_fixed: the number of valid iterations, the norm of the first
+	//step, and the mean per-iteration contraction of the step norm (0 when fewer than two iterations ran)
+	int get_iter_num() const {
+		return iter_num_;
+	}
+	scalar_type get_dx_first_norm() const {
+		return dx_first_norm_;
+	}
+	scalar_type get_dx_rate() const {
+		return dx_rate_;
+	}
 private:
 	state x_;
 	measurement m_;
@@ -1962,10 +2178,15 @@ private:
 	cov F_x1 = cov::Identity();
 	cov F_x2 = cov::Identity();
 	cov L_ = cov::Identity();
+	int iter_num_ = 0;
+	scalar_type dx_first_norm_ = 0;
+	scalar_type dx_rate_ = 0;
 
 	processModel *f;
 	processMatrix1 *f_x;
 	processMatrix2 *f_w;
+	processMatrix1Mul *f_x_mul = nullptr;
+	processMatrix2Cov *f_w_cov = nullptr;
 
 	measurementModel *h;
 	measurementMatrix1 *h_x;
@@ -0,0 +1,208 @@
+#ifndef FOV_CULLER_H
+#define FOV_CULLER_H
+
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <unordered_map>
+#include <common_lib.h>
+#include <ikd-Tree/ikd_Tree.h>
+
+/*
+ * Keeps the ikd-Tree restricted to the part of the local map a limited-FOV LiDAR can see.
+ * The map is divided into cubic blocks. Blocks that fall outside the view cone (apex at the LiDAR, axis along its
+ * x axis, half angle acos(half_fov_cos), length det_range) are copied out of the tree and deleted from it
+ * ("parked"); parked blocks are inserted back once they come into view again.
+ */
+class FovMapCuller
+{
+public:
+    void set_param(double block_size, double half_fov_cos, double det_range)
+    {
+        block_size_ = block_size;
+        half_fov_ = acos(half_fov_cos);
+        det_range_ = det_range;
+    }
+
+    void reset()
+    {
+        active_.clear();
+        parked_.clear();
+        parked_num_ = 0;
+    }
+
+    int parked_points() const
+    {
+        return parked_num_;
+    }
+
+    /*** append the points currently taken out of the tree ***/
+    void append_parked(PointVector &points) const
+    {
+        for (const auto &block : parked_) points.insert(points.end(), block.second.begin(), block.second.end());
+    }
+
+    /*** register points inserted into the tree, so their blocks can be culled later ***/
+    void add_points(const PointVector &points)
+    {
+        for (const PointType &p : points) active_[key_of(p.x, p.y, p.z)] = true;
+    }
+
+    /*** drop the parked copies of points deleted from the tree; points that are not parked are ignored ***/
+    void remove_points(const PointVector &points)
+    {
+        removal_.clear();
+        for (const PointType &p : points)
+        {
+            BlockKey k = key_of(p.x, p.y, p.z);
+            if (parked_.count(k) > 0) removal_[k].push_back(p);
+        }
+        for (auto &item : removal_)
+        {
+            PointVector &storage = parked_[item.first];
+            PointVector &gone = item.second;
+            sort(gone.begin(), gone.end(), coord_less);
+            auto end = remove_if(storage.begin(), storage.end(), [&gone](const PointType &p){ return binary_search(gone.begin(), gone.end(), p, coord_less); });
+            parked_num_ -= storage.end() - end;
+            storage.erase(end, storage.end());
+        }
+        removal_.clear();
+    }
+
+    /*** forget blocks, parked or not, whose center lies in one of the boxes removed from the local map,
+         the parked points dropped are appended to removed when given ***/
+    void remove_boxes(const vector<BoxPointType> &boxes, PointVector *removed = nullptr)
+    {
+        for (auto it = active_.begin(); it != active_.end();)
+        {
+            if (in_boxes(center_of(it->first), boxes)) it = active_.erase(it);
+            else it ++;
+        }
+        for (auto it = parked_.begin(); it != parked_.end();)
+        {
+            if (in_boxes(center_of(it->first), boxes))
+            {
+                parked_num_ -= it->second.size();
+                if (removed != nullptr) removed->insert(removed->end(), it->second.begin(), it->second.end());
+                it = parked_.erase(it);
+            }
+            else it ++;
+        }
+    }
+
+    /*
+    * @brief : park the blocks that left the view cone and restore the ones that entered it
+    * @param pos  : LiDAR position in the world frame
+    * @param axis : unit viewing direction in the world frame
+    * @return number of points moved in or out of the tree
+    */
+    int update(KD_TREE<PointType> &tree, const V3D &pos, const V3D &axis)
+    {
+        int moved = 0;
+        for (auto it = parked_.begin(); it != parked_.end();)
+        {
+            if (in_view(center_of(it->first), pos, axis))
+            {
+                tree.Add_Points(it->second, false);
+                moved += it->second.size();
+                parked_num_ -= it->second.size();
+                active_[it->first] = true;
+                it = parked_.erase(it);
+            }
+            else it ++;
+        }
+
+        vector<BoxPointType> boxes;
+        for (auto it = active_.begin(); it != active_.end();)
+        {
+            if (in_view(center_of(it->first), pos, axis))
+            {
+                it ++;
+                continue;
+            }
+            /*** search into a cleared scratch buffer and append: the block may already hold points parked before ***/
+            BoxPointType box = box_of(it->first);
+            search_buf_.clear();
+            tree.Box_Search(box, search_buf_);
+            PointVector &storage = parked_[it->first];
+            storage.insert(storage.end(), search_buf_.begin(), search_buf_.end());
+            parked_num_ += search_buf_.size();
+            moved += search_buf_.size();
+            boxes.push_back(box);
+            it = active_.erase(it);
+        }
+        if (!boxes.empty()) tree.Delete_Point_Boxes(boxes);
+        return moved;
+    }
+
+private:
+    typedef Eigen::Vector3i BlockKey;
+
+    struct KeyHash
+    {
+        size_t operator()(const BlockKey &k) const
+        {
+            return size_t(((int64_t(k(0)) * 73856093) ^ (int64_t(k(1)) * 471943) ^ (int64_t(k(2)) * 83492791)) % 10000000019LL);
+        }
+    };
+
+    BlockKey key_of(double x, double y, double z) const
+    {
+        return BlockKey(int(floor(x / block_size_)), int(floor(y / block_size_)), int(floor(z / block_size_)));
+    }
+
+    V3D center_of(const BlockKey &k) const
+    {
+        return (k.cast<double>() + V3D::Constant(0.5)) * block_size_;
+    }
+
+    BoxPointType box_of(const BlockKey &k) const
+    {
+        BoxPointType box;
+        for (int i = 0; i < 3; i++)
+        {
+            box.vertex_min[i] = k(i) * block_size_;
+            box.vertex_max[i] = (k(i) + 1) * block_size_;
+        }
+        return box;
+    }
+
+    /*** whether a block, grown by one block as a margin for motion, intersects the view cone ***/
+    bool in_view(const V3D &center, const V3D &pos, const V3D &axis) const
+    {
+        const double radius = block_size_ * (0.5 * sqrt(3.0) + 1.0);
+        V3D v = center - pos;
+        double dist = v.norm();
+        if (dist <= radius) return true;
+        if (dist - radius > det_range_) return false;
+        double angle = acos(CONSTRAIN(v.dot(axis) / dist, -1.0, 1.0));
+        return angle <= half_fov_ + asin(radius / dist);
+    }
+
+    static bool coord_less(const PointType &a, const PointType &b)
+    {
+        if (a.x != b.x) return a.x < b.x;
+        if (a.y != b.y) return a.y < b.y;
+        return a.z < b.z;
+    }
+
+    static bool in_boxes(const V3D &p, const vector<BoxPointType> &boxes)
+    {
+        for (const BoxPointType &box : boxes)
+        {
+            if (p(0) >= box.vertex_min[0] && p(0) <= box.vertex_max[0] &&
+                p(1) >= box.vertex_min[1] && p(1) <= box.vertex_max[1] &&
+                p(2) >= box.vertex_min[2] && p(2) <= box.vertex_max[2]) return true;
+        }
+        return false;
+    }
+
+    unordered_map<BlockKey, bool, KeyHash>        active_;   // blocks with points in the tree
+    unordered_map<BlockKey, PointVector, KeyHash> parked_;   // points of the blocks taken out of the tree
+    unordered_map<BlockKey, PointVector, KeyHash> removal_;  // points to drop, by parked block
+    PointVector search_buf_;
+    double block_size_ = 10.0, half_fov_ = M_PI, det_range_ = 300.0;
+    int    parked_num_ = 0;
+};
+
+#endif
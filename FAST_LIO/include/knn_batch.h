@@ -0,0 +1,99 @@
+#ifndef KNN_BATCH_H
+#define KNN_BATCH_H
+
+#include <omp.h>
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <common_lib.h>
+#include <ikd-Tree/ikd_Tree.h>
+
+/*
+ * Batched k-nearest-neighbor search on the ikd-Tree map.
+ * Queries are visited in Morton (Z-order) order, so consecutive searches, and the contiguous share of them
+ * each thread gets, descend the same tree paths while those nodes are still cached. Results are written to
+ * flat buffers indexed by the original query order. Apart from the first batches, which size the per-thread
+ * buffers, a batch allocates nothing here; ikd-Tree still builds its search heap inside each Nearest_Search.
+ */
+class KnnBatch
+{
+public:
+    /*
+    * @param tree        : the map, a KD_TREE<PointType> or any type with its Nearest_Search
+    * @param queries     : n query points
+    * @param k           : neighbors per query
+    * @param cell        : grid size used to quantize the queries for the Morton order, e.g. the map resolution
+    * @param nearest     : n * k output points, the neighbors of query i start at nearest[i * k]
+    * @param nearest_num : n outputs, neighbors found for each query (at most k)
+    * @param kth_sq_dist : n outputs, squared distance of the farthest returned neighbor
+    * @param skip        : optional n flags, queries flagged non-zero are not searched and get no neighbors
+    */
+    template<typename Tree>
+    void search(Tree &tree, const PointType *queries, int n, int k, double cell,
+                PointType *nearest, int *nearest_num, float *kth_sq_dist, const uint8_t *skip = nullptr)
+    {
+        double inv_cell = cell > 0.0 ? 1.0 / cell : 1.0;
+        order_.clear();
+        for (int i = 0; i < n; i++)
+        {
+            if (skip != nullptr && skip[i])
+            {
+                nearest_num[i] = 0;
+                kth_sq_dist[i] = INFINITY;
+                continue;
+            }
+            order_.push_back(make_pair(morton_code(queries[i], inv_cell), i));
+        }
+        std::sort(order_.begin(), order_.end());
+        const int m = order_.size();
+
+        int thread_num = omp_get_max_threads();
+        if (int(pts_buf_.size()) < thread_num)
+        {
+            pts_buf_.resize(thread_num);
+            dis_buf_.resize(thread_num);
+        }
+
+        #ifdef MP_EN
+            #pragma omp parallel for schedule(static)
+        #endif
+        for (int j = 0; j < m; j++)
+        {
+            const int i = order_[j].second;
+            PointVector &pts = pts_buf_[omp_get_thread_num()];
+            vector<float> &dis = dis_buf_[omp_get_thread_num()];
+            tree.Nearest_Search(queries[i], k, pts, dis);
+            nearest_num[i] = min(int(pts.size()), k);
+            std::copy(pts.begin(), pts.begin() + nearest_num[i], nearest + (long)i * k);
+            kth_sq_dist[i] = nearest_num[i] > 0 ? dis[nearest_num[i] - 1] : INFINITY;
+        }
+    }
+
+private:
+    /*** interleave 21 bits of each quantized coordinate ***/
+    static uint64_t spread_bits(uint64_t v)
+    {
+        v &= 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffffULL;
+        v = (v | v << 16) & 0x1f0000ff0000ffULL;
+        v = (v | v << 8)  & 0x100f00f00f00f00fULL;
+        v = (v | v << 4)  & 0x10c30c30c30c30c3ULL;
+        v = (v | v << 2)  & 0x1249249249249249ULL;
+        return v;
+    }
+
+    static uint64_t morton_code(const PointType &p, double inv_cell)
+    {
+        const double offset = double(1 << 20);   // centers the 21-bit grid on the origin
+        uint64_t x = uint64_t(CONSTRAIN(floor(p.x * inv_cell) + offset, 0.0, 2097151.0));
+        uint64_t y = uint64_t(CONSTRAIN(floor(p.y * inv_cell) + offset, 0.0, 2097151.0));
+        uint64_t z = uint64_t(CONSTRAIN(floor(p.z * inv_cell) + offset, 0.0, 2097151.0));
+        return spread_bits(x) | spread_bits(y) << 1 | spread_bits(z) << 2;
+    }
+
+    vector<pair<uint64_t, int>> order_;
+    vector<PointVector>         pts_buf_;   // per-thread search output, reused across batches
+    vector<vector<float>>       dis_buf_;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef LIDAR_MERGER_H
+#define LIDAR_MERGER_H
+
+#include <math.h>
+#include <deque>
+#include <algorithm>
+#include <common_lib.h>
+
+/*
+ * Merges the preprocessed scans of several LiDARs into one scan per scan of the primary LiDAR (source 0).
+ * Points of the other sources are moved into the primary LiDAR frame, and the ones whose absolute time falls in
+ * the primary scan's time window [begin, end] are added with their offset time re-based to the window begin. The
+ * merged scan is sorted by point time, so it is deskewed and registered as if a single LiDAR had captured it.
+ * Points after the window wait for the next primary scan; points before it came too late and are dropped.
+ */
+class LidarMerger
+{
+public:
+    /*** returns the index of the new source; the first one added is the primary LiDAR ***/
+    int add_source(const M3D &R_to_primary, const V3D &T_to_primary)
+    {
+        sources_.emplace_back();
+        sources_.back().R = R_to_primary;
+        sources_.back().T = T_to_primary;
+        return sources_.size() - 1;
+    }
+
+    int source_num() const
+    {
+        return sources_.size();
+    }
+
+    /*** a primary scan is waiting for the other sources ***/
+    bool primary_waiting() const
+    {
+        return !sources_.empty() && !sources_[0].scans.empty();
+    }
+
+    /*** queue a preprocessed scan of source idx, in its own frame, curvature holding the point offset time in ms ***/
+    void push(int idx, const PointCloudXYZI::Ptr &scan, double beg_time)
+    {
+        Source &src = sources_[idx];
+        float end_ms = 0.0f;
+        if (idx > 0)
+        {
+            for (PointType &p : scan->points)
+            {
+                V3D pt = src.R * V3D(p.x, p.y, p.z) + src.T;
+                p.x = pt(0); p.y = pt(1); p.z = pt(2);
+            }
+        }
+        for (const PointType &p : scan->points) end_ms = max(end_ms, p.curvature);
+        src.scans.push_back(scan);
+        src.beg_times.push_back(beg_time);
+        src.end_times.push_back(beg_time + end_ms / double(1000));
+        src.latest_end = max(src.latest_end, src.end_times.back());
+    }
+
+    /*
+    * @brief : Merge the oldest primary scan once every other source has delivered points past its end, or a newer
+    *          primary scan is already queued (a silent source delays the output by one scan at most).
+    * @return false when no merged scan is ready
+    */
+    bool pop(PointCloudXYZI::Ptr &merged, double &beg_time)
+    {
+        if (sources_.empty() || sources_[0].scans.empty()) return false;
+        Source &primary = sources_[0];
+        const double b0 = primary.beg_times.front(), e0 = primary.end_times.front();
+        if (primary.scans.size() == 1)
+        {
+            for (size_t k = 1; k < sources_.size(); k++)
+            {
+                if (sources_[k].latest_end < e0) return false;
+            }
+        }
+
+        merged = primary.scans.front();
+        beg_time = b0;
+        const size_t primary_size = merged->size();
+        primary.scans.pop_front();
+        primary.beg_times.pop_front();
+        primary.end_times.pop_front();
+
+        for (size_t k = 1; k < sources_.size(); k++)
+        {
+            Source &src = sources_[k];
+            while (!src.scans.empty())
+            {
+                PointCloudXYZI &scan = *src.scans.front();
+                const double b = src.beg_times.front();
+                size_t rest = 0;
+                for (const PointType &p : scan.points)
+                {
+                    double t = b + p.curvature / double(1000);
+                    if (t < b0) continue;
+                    if (t <= e0)
+                    {
+                        PointType q = p;
+                        q.curvature = (t - b0) * 1000.0;
+                        merged->push_back(q);
+                    }
+                    else scan.points[rest ++] = p;
+                }
+                if (rest > 0)
+                {
+                    scan.points.resize(rest);
+                    scan.width = rest;
+                    scan.height = 1;
+                    break;
+                }
+                src.scans.pop_front();
+                src.beg_times.pop_front();
+                src.end_times.pop_front();
+            }
+        }
+
+        /*** the appended points interleave with the primary ones in time; sync_packages takes the scan end from
+             the last point, so keep the merged scan in point time order ***/
+        if (merged->size() > primary_size)
+        {
+            sort(merged->points.begin(), merged->points.end(), [](const PointType &a, const PointType &b){ return a.curvature < b.curvature; });
+        }
+        return true;
+    }
+
+    void clear()
+    {
+        for (Source &src : sources_)
+        {
+            src.scans.clear();
+            src.beg_times.clear();
+            src.end_times.clear();
+            src.latest_end = -1.0;
+        }
+    }
+
+private:
+    struct Source
+    {
+        M3D R = M3D::Identity();
+        V3D T = V3D::Zero();
+        deque<PointCloudXYZI::Ptr> scans;
+        deque<double> beg_times, end_times;
+        double latest_end = -1.0;
+    };
+    deque<Source> sources_;
+};
+
+#endif
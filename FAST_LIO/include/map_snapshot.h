@@ -0,0 +1,253 @@
+#ifndef MAP_SNAPSHOT_H
+#define MAP_SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <common_lib.h>
+#include <use-ikfom.hpp>
+
+/*
+ * Binary snapshot of the map points and the filter state, for restarting without re-driving the area.
+ * Layout: MapSnapshotHeader followed by point_num raw PointType records. Snapshots are written to a temporary file
+ * and renamed over the old one, so a crash while saving leaves the previous snapshot intact.
+ */
+#define MAP_SNAPSHOT_VERSION (1)
+
+struct MapSnapshotHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t point_size;          // sizeof(PointType) of the writer
+    uint64_t point_num;
+    double   lidar_end_time;
+    double   pos[3];
+    double   rot[4];              // quaternion w, x, y, z
+    double   vel[3];
+    double   bg[3];
+    double   ba[3];
+    double   grav[3];
+};
+
+static const char MAP_SNAPSHOT_MAGIC[8] = {'F', 'L', 'I', 'O', 'M', 'A', 'P', '\0'};
+
+inline bool save_map_snapshot(const string &path, const PointVector &points, const state_ikfom &state, double lidar_end_time)
+{
+    MapSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAP_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = MAP_SNAPSHOT_VERSION;
+    header.point_size = sizeof(PointType);
+    header.point_num = points.size();
+    header.lidar_end_time = lidar_end_time;
+    V3D grav = state.grav.get_vect();
+    for (int i = 0; i < 3; i++)
+    {
+        header.pos[i] = state.pos(i);
+        header.vel[i] = state.vel(i);
+        header.bg[i] = state.bg(i);
+        header.ba[i] = state.ba(i);
+        header.grav[i] = grav(i);
+    }
+    header.rot[0] = state.rot.w(); header.rot[1] = state.rot.x(); header.rot[2] = state.rot.y(); header.rot[3] = state.rot.z();
+
+    string tmp_path = path + ".tmp";
+    FILE *fp = fopen(tmp_path.c_str(), "wb");
+    if (fp == nullptr) return false;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(points.data(), sizeof(PointType), points.size(), fp) == points.size();
+    ok = (fflush(fp) == 0) && ok;
+    ok = (fsync(fileno(fp)) == 0) && ok;
+    fclose(fp);
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Writes snapshots with save_map_snapshot on a background thread, so the caller only pays for copying the points.
+ * A request made while an earlier one is still waiting replaces it; the one being written is finished first.
+ */
+class MapSnapshotWriter
+{
+public:
+    ~MapSnapshotWriter()
+    {
+        stop();
+    }
+
+    /*** queue a snapshot, points is moved out ***/
+    void request(const string &path, PointVector &points, const state_ikfom &state, double lidar_end_time)
+    {
+        {
+            lock_guard<mutex> lock(mtx_);
+            path_ = path;
+            points_.swap(points);
+            state_ = state;
+            lidar_end_time_ = lidar_end_time;
+            pending_ = true;
+            if (!thread_.joinable()) thread_ = thread(&MapSnapshotWriter::write_loop, this);
+        }
+        PointVector().swap(points);
+        sig_.notify_one();
+    }
+
+    /*** failed writes since the last call ***/
+    int take_failures()
+    {
+        lock_guard<mutex> lock(mtx_);
+        int failed = failed_;
+        failed_ = 0;
+        return failed;
+    }
+
+    /*** finish the queued snapshot and stop the thread ***/
+    void stop()
+    {
+        if (!thread_.joinable()) return;
+        {
+            lock_guard<mutex> lock(mtx_);
+            exit_ = true;
+        }
+        sig_.notify_one();
+        thread_.join();
+    }
+
+private:
+    void write_loop()
+    {
+        unique_lock<mutex> lock(mtx_);
+        while (true)
+        {
+            sig_.wait(lock, [this]{ return exit_ || pending_; });
+            if (!pending_) break;
+            string path = path_;
+            PointVector points;
+            points.swap(points_);
+            state_ikfom state = state_;
+            double lidar_end_time = lidar_end_time_;
+            pending_ = false;
+            lock.unlock();
+
+            bool ok = save_map_snapshot(path, points, state, lidar_end_time);
+
+            lock.lock();
+            if (!ok) failed_ ++;
+        }
+    }
+
+    thread      thread_;
+    mutex       mtx_;
+    condition_variable sig_;
+    string      path_;
+    PointVector points_;
+    state_ikfom state_;
+    double      lidar_end_time_ = 0.0;
+    bool        pending_ = false, exit_ = false;
+    int         failed_ = 0;
+};
+
+/*** read-only memory mapping of a snapshot file ***/
+class MapSnapshotReader
+{
+public:
+    ~MapSnapshotReader()
+    {
+        close();
+    }
+
+    /*** returns false, with the reason in error(), when the file is missing or not a snapshot of this build ***/
+    bool open(const string &path)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            error_ = "can not open " + path;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(MapSnapshotHeader))
+        {
+            ::close(fd);
+            error_ = path + " is too short";
+            return false;
+        }
+        data_ = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data_ == MAP_FAILED)
+        {
+            data_ = nullptr;
+            error_ = "can not map " + path;
+            return false;
+        }
+        size_ = st.st_size;
+        madvise(data_, size_, MADV_SEQUENTIAL);
+
+        const MapSnapshotHeader &h = header();
+        if (memcmp(h.magic, MAP_SNAPSHOT_MAGIC, sizeof(h.magic)) != 0 || h.version != MAP_SNAPSHOT_VERSION || h.point_size != sizeof(PointType))
+            error_ = path + " is not a map snapshot of this version";
+        else if (sizeof(MapSnapshotHeader) + h.point_num * sizeof(PointType) > size_)
+            error_ = path + " is truncated";
+        else return true;
+        close();
+        return false;
+    }
+
+    void close()
+    {
+        if (data_ != nullptr) munmap(data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    const MapSnapshotHeader &header() const
+    {
+        return *static_cast<const MapSnapshotHeader *>(data_);
+    }
+
+    const PointType *points() const
+    {
+        return reinterpret_cast<const PointType *>(static_cast<const char *>(data_) + sizeof(MapSnapshotHeader));
+    }
+
+    size_t point_num() const
+    {
+        return header().point_num;
+    }
+
+    /*** writes pos, rot, vel, bg, ba and grav of the snapshot into state, the extrinsic is left untouched ***/
+    void get_state(state_ikfom &state) const
+    {
+        const MapSnapshotHeader &h = header();
+        state.pos = V3D(h.pos[0], h.pos[1], h.pos[2]);
+        state.rot = Eigen::Quaterniond(h.rot[0], h.rot[1], h.rot[2], h.rot[3]).normalized();
+        state.vel = V3D(h.vel[0], h.vel[1], h.vel[2]);
+        state.bg = V3D(h.bg[0], h.bg[1], h.bg[2]);
+        state.ba = V3D(h.ba[0], h.ba[1], h.ba[2]);
+        state.grav = S2(V3D(h.grav[0], h.grav[1], h.grav[2]));
+    }
+
+    const string &error() const
+    {
+        return error_;
+    }
+
+private:
+    void  *data_ = nullptr;
+    size_t size_ = 0;
+    string error_;
+};
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef MAP_TILES_H
+#define MAP_TILES_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <common_lib.h>
+#include <ikd-Tree/ikd_Tree.h>
+
+/*
+ * On-disk store for the map points that leave the local map cube.
+ * Points are grouped into square tiles of tile_size in x-y, each tile kept as raw PointType records in its own
+ * file. When the cube moves back over a tile, the tile's points inside the cube are handed back and the rest stay
+ * in the store, so every map point is either in the map or in the store, never both.
+ * The files are read and written by a background thread in request order. The caller only swaps points in
+ * memory: prefetch() reads the tiles around the cube before it moves there and writes back the resident tiles
+ * far from it, so load() usually finds its tiles in memory and waits for the disk only on a prefetch miss.
+ */
+class MapTileStore
+{
+public:
+    ~MapTileStore()
+    {
+        stop();
+    }
+
+    /*** returns false when the directory can not be created; starts the I/O thread ***/
+    bool set_param(const string &dir, double tile_size)
+    {
+        dir_ = dir;
+        if (!dir_.empty() && dir_.back() != '/') dir_ += '/';
+        tile_size_ = tile_size;
+        mkdir(dir_.c_str(), 0755);
+        struct stat st;
+        if (stat(dir_.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return false;
+        if (!io_thread_.joinable()) io_thread_ = thread(&MapTileStore::io_loop, this);
+        return true;
+    }
+
+    int tile_num() const
+    {
+        return tiles_.size();
+    }
+
+    long stored_points() const
+    {
+        return stored_num_;
+    }
+
+    /*** tiles load() had to wait for because they were not prefetched ***/
+    int prefetch_misses() const
+    {
+        return miss_num_;
+    }
+
+    /*** hand points to their tiles, returns the number stored ***/
+    int save(const PointVector &points)
+    {
+        if (points.empty()) return 0;
+        groups_.clear();
+        for (const PointType &p : points) groups_[key_of(p.x, p.y)].push_back(p);
+        for (auto &group : groups_)
+        {
+            if (tiles_.count(group.first) == 0 && prefetch_set_ && overlaps(group.first, prefetch_box_, 0))
+            {
+                /*** a new tile next to the cube stays in memory, load() would soon read it back ***/
+                tiles_[group.first].state = RESIDENT;
+            }
+            Tile &tile = tiles_[group.first];
+            if (tile.state == ON_DISK)
+            {
+                /*** the first write of a tile in this session truncates whatever an earlier run left in its file ***/
+                push_job(tile.has_file ? APPEND : WRITE, group.first, std::move(group.second));
+                tile.has_file = true;
+            }
+            else tile.points.insert(tile.points.end(), group.second.begin(), group.second.end());
+        }
+        stored_num_ += points.size();
+        return points.size();
+    }
+
+    /*
+    * @brief : Read the tiles overlapping box into memory ahead of load(), and write back the resident tiles that
+    *          are more than a tile away from it. Call it every frame with the region the cube may move into.
+    */
+    void prefetch(const BoxPointType &box)
+    {
+        prefetch_box_ = box;
+        prefetch_set_ = true;
+        collect_reads();
+        for (auto it = tiles_.begin(); it != tiles_.end();)
+        {
+            Tile &tile = it->second;
+            if (tile.state == ON_DISK && overlaps(it->first, box, 0))
+            {
+                push_job(READ, it->first, PointVector());
+                tile.state = READING;
+            }
+            else if (tile.state == RESIDENT && !overlaps(it->first, box, 1))
+            {
+                if (tile.points.empty())
+                {
+                    if (tile.has_file) push_job(REMOVE, it->first, PointVector());
+                    it = tiles_.erase(it);
+                    continue;
+                }
+                push_job(WRITE, it->first, std::move(tile.points));
+                PointVector().swap(tile.points);
+                tile.state = ON_DISK;
+                tile.has_file = true;
+            }
+            it ++;
+        }
+    }
+
+    /*** move the stored points inside the box back into memory, returns the number of points moved ***/
+    int load(const BoxPointType &box, PointVector &points)
+    {
+        collect_reads();
+        wait_keys_.clear();
+        for (auto &item : tiles_)
+        {
+            if (!overlaps(item.first, box, 0) || item.second.state == RESIDENT) continue;
+            if (item.second.state == ON_DISK)
+            {
+                push_job(READ, item.first, PointVector());
+                item.second.state = READING;
+                miss_num_ ++;
+            }
+            wait_keys_.push_back(item.first);
+        }
+        if (!wait_keys_.empty())
+        {
+            unique_lock<mutex> lock(mtx_);
+            sig_done_.wait(lock, [this]{
+                for (uint64_t key : wait_keys_) if (done_.count(key) == 0) return false;
+                return true;
+            });
+        }
+        collect_reads();
+
+        int read = 0;
+        for (auto it = tiles_.begin(); it != tiles_.end();)
+        {
+            Tile &tile = it->second;
+            if (tile.state != RESIDENT || !overlaps(it->first, box, 0))
+            {
+                it ++;
+                continue;
+            }
+            rest_buf_.clear();
+            for (const PointType &p : tile.points)
+            {
+                if (in_box(p, box))
+                {
+                    points.push_back(p);
+                    read ++;
+                }
+                else rest_buf_.push_back(p);
+            }
+            tile.points.swap(rest_buf_);
+            if (tile.points.empty())
+            {
+                if (tile.has_file) push_job(REMOVE, it->first, PointVector());
+                it = tiles_.erase(it);
+                continue;
+            }
+            it ++;
+        }
+        stored_num_ -= read;
+        return read;
+    }
+
+    /*** delete the tile files written in this session ***/
+    void clear()
+    {
+        for (auto &item : tiles_)
+        {
+            if (item.second.has_file) push_job(REMOVE, item.first, PointVector());
+        }
+        if (io_thread_.joinable())
+        {
+            unique_lock<mutex> lock(mtx_);
+            sig_done_.wait(lock, [this]{ return jobs_.empty() && !io_busy_; });
+            done_.clear();
+        }
+        tiles_.clear();
+        stored_num_ = 0;
+    }
+
+    /*** finish the queued writes and stop the I/O thread ***/
+    void stop()
+    {
+        if (!io_thread_.joinable()) return;
+        {
+            lock_guard<mutex> lock(mtx_);
+            io_exit_ = true;
+        }
+        sig_job_.notify_one();
+        io_thread_.join();
+    }
+
+private:
+    enum TileState {ON_DISK, READING, RESIDENT};
+    enum JobType {APPEND, WRITE, READ, REMOVE};
+
+    /*
+     * ON_DISK : the file holds all the tile's points
+     * READING : the file is being read, points holds the ones stored since the read was requested
+     * RESIDENT: points holds all the tile's points, the file is stale
+     */
+    struct Tile
+    {
+        TileState   state = ON_DISK;
+        bool        has_file = false;
+        PointVector points;
+    };
+
+    struct IoJob
+    {
+        JobType     type;
+        uint64_t    key;
+        PointVector points;
+    };
+
+    void push_job(JobType type, uint64_t key, PointVector points)
+    {
+        {
+            lock_guard<mutex> lock(mtx_);
+            jobs_.push_back(IoJob{type, key, std::move(points)});
+        }
+        sig_job_.notify_one();
+    }
+
+    /*** merge the finished reads into their tiles, after the points stored while they were read ***/
+    void collect_reads()
+    {
+        {
+            lock_guard<mutex> lock(mtx_);
+            read_buf_.swap(done_);
+        }
+        for (auto &item : read_buf_)
+        {
+            Tile &tile = tiles_[item.first];
+            item.second.insert(item.second.end(), tile.points.begin(), tile.points.end());
+            tile.points.swap(item.second);
+            tile.state = RESIDENT;
+        }
+        read_buf_.clear();
+    }
+
+    void io_loop()
+    {
+        unique_lock<mutex> lock(mtx_);
+        while (true)
+        {
+            sig_job_.wait(lock, [this]{ return io_exit_ || !jobs_.empty(); });
+            if (jobs_.empty()) break;
+            IoJob job = std::move(jobs_.front());
+            jobs_.pop_front();
+            io_busy_ = true;
+            lock.unlock();
+
+            string file = file_of(job.key);
+            PointVector tile;
+            if (job.type == READ)
+            {
+                FILE *fp = fopen(file.c_str(), "rb");
+                if (fp != nullptr)
+                {
+                    fseek(fp, 0, SEEK_END);
+                    tile.resize(ftell(fp) / sizeof(PointType));
+                    fseek(fp, 0, SEEK_SET);
+                    tile.resize(fread(tile.data(), sizeof(PointType), tile.size(), fp));
+                    fclose(fp);
+                }
+            }
+            else if (job.type == REMOVE) remove(file.c_str());
+            else
+            {
+                FILE *fp = fopen(file.c_str(), job.type == APPEND ? "ab" : "wb");
+                if (fp != nullptr)
+                {
+                    fwrite(job.points.data(), sizeof(PointType), job.points.size(), fp);
+                    fclose(fp);
+                }
+            }
+
+            lock.lock();
+            if (job.type == READ) done_[job.key].swap(tile);
+            io_busy_ = false;
+            sig_done_.notify_all();
+        }
+    }
+
+    static bool in_box(const PointType &p, const BoxPointType &box)
+    {
+        return p.x >= box.vertex_min[0] && p.x <= box.vertex_max[0] &&
+               p.y >= box.vertex_min[1] && p.y <= box.vertex_max[1] &&
+               p.z >= box.vertex_min[2] && p.z <= box.vertex_max[2];
+    }
+
+    /*** the tile is within margin tiles of the box in x-y ***/
+    bool overlaps(uint64_t key, const BoxPointType &box, int margin) const
+    {
+        int64_t tx = int64_t(key >> 32) - (1LL << 31), ty = int64_t(key & 0xffffffff) - (1LL << 31);
+        return tx >= int64_t(floor(box.vertex_min[0] / tile_size_)) - margin && tx <= int64_t(floor(box.vertex_max[0] / tile_size_)) + margin &&
+               ty >= int64_t(floor(box.vertex_min[1] / tile_size_)) - margin && ty <= int64_t(floor(box.vertex_max[1] / tile_size_)) + margin;
+    }
+
+    uint64_t key_of(double x, double y) const
+    {
+        uint64_t kx = uint64_t(int64_t(floor(x / tile_size_)) + (1LL << 31)) & 0xffffffff;
+        uint64_t ky = uint64_t(int64_t(floor(y / tile_size_)) + (1LL << 31)) & 0xffffffff;
+        return kx << 32 | ky;
+    }
+
+    string file_of(uint64_t key) const
+    {
+        return dir_ + "tile_" + to_string(int64_t(key >> 32) - (1LL << 31)) + "_" + to_string(int64_t(key & 0xffffffff) - (1LL << 31)) + ".bin";
+    }
+
+    string dir_;
+    double tile_size_ = 20.0;
+    unordered_map<uint64_t, Tile> tiles_;              // every tile holding points, on disk or in memory
+    unordered_map<uint64_t, PointVector> groups_;
+    PointVector rest_buf_;
+    vector<uint64_t> wait_keys_;
+    BoxPointType prefetch_box_;
+    bool prefetch_set_ = false;
+    long stored_num_ = 0;
+    int  miss_num_ = 0;
+
+    /*** shared with the I/O thread ***/
+    thread io_thread_;
+    mutex mtx_;
+    condition_variable sig_job_, sig_done_;
+    deque<IoJob> jobs_;
+    unordered_map<uint64_t, PointVector> done_, read_buf_;   // finished reads, by tile
+    bool io_busy_ = false, io_exit_ = false;
+};
+
+#endif
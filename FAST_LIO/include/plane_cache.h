@@ -0,0 +1,131 @@
+#ifndef PLANE_CACHE_H
+#define PLANE_CACHE_H
+
+#include <math.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <Eigen/Eigenvalues>
+#include <common_lib.h>
+#include <ikd-Tree/ikd_Tree.h>
+
+/*** plane fitted to the map points of one voxel ***/
+struct VoxelPlane
+{
+    int    num = 0;                        // points accumulated
+    V3D    sum = V3D::Zero();
+    M3D    sum_sq = M3D::Zero();           // sum of p * p^T
+    V3D    normal = V3D::Zero();           // unit normal, the plane is normal . p + d = 0
+    double d = 0.0;
+    double sigma = INFINITY;               // fit quality: std of the point-to-plane distances
+    bool   valid = false;
+    int    batch = -1;                     // last add_points batch that touched the voxel
+};
+
+/*
+ * Per-voxel plane estimates of the map, kept in sync with the ikd-Tree by feeding it the same points that
+ * are added to, and the boxes that are deleted from, the tree. Each voxel keeps the first and second moments
+ * of its points, so adding points is O(1) and only the voxels touched by a batch are refitted.
+ */
+class VoxelPlaneCache
+{
+public:
+    void set_param(double voxel_size, int min_points, double max_sigma)
+    {
+        inv_voxel_ = 1.0 / voxel_size;
+        min_points_ = min_points;
+        max_sigma_ = max_sigma;
+    }
+
+    void clear()
+    {
+        voxels_.clear();
+    }
+
+    int size() const
+    {
+        return voxels_.size();
+    }
+
+    void add_points(const PointVector &points)
+    {
+        touched_.clear();
+        batch_ ++;
+        for (const PointType &p : points)
+        {
+            VoxelPlane &voxel = voxels_[key_of(p.x, p.y, p.z)];
+            if (voxel.batch != batch_)
+            {
+                voxel.batch = batch_;
+                touched_.push_back(&voxel);
+            }
+            V3D pt(p.x, p.y, p.z);
+            voxel.num ++;
+            voxel.sum += pt;
+            voxel.sum_sq += pt * pt.transpose();
+        }
+        for (VoxelPlane *voxel : touched_) fit(*voxel);
+    }
+
+    /*** drop the voxels whose center lies in one of the boxes ***/
+    void remove_boxes(const vector<BoxPointType> &boxes)
+    {
+        for (auto it = voxels_.begin(); it != voxels_.end();)
+        {
+            V3D center = it->second.sum / max(it->second.num, 1);
+            bool inside = false;
+            for (const BoxPointType &box : boxes)
+            {
+                if (center(0) >= box.vertex_min[0] && center(0) <= box.vertex_max[0] &&
+                    center(1) >= box.vertex_min[1] && center(1) <= box.vertex_max[1] &&
+                    center(2) >= box.vertex_min[2] && center(2) <= box.vertex_max[2])
+                {
+                    inside = true;
+                    break;
+                }
+            }
+            if (inside) it = voxels_.erase(it);
+            else it ++;
+        }
+    }
+
+    /*** plane of the voxel containing p, nullptr when that voxel has no reliable plane ***/
+    const VoxelPlane *find(const PointType &p) const
+    {
+        auto it = voxels_.find(key_of(p.x, p.y, p.z));
+        if (it == voxels_.end() || !it->second.valid) return nullptr;
+        return &it->second;
+    }
+
+private:
+    uint64_t key_of(double x, double y, double z) const
+    {
+        const int64_t offset = 1 << 20;
+        uint64_t kx = uint64_t(int64_t(floor(x * inv_voxel_)) + offset) & 0x1fffff;
+        uint64_t ky = uint64_t(int64_t(floor(y * inv_voxel_)) + offset) & 0x1fffff;
+        uint64_t kz = uint64_t(int64_t(floor(z * inv_voxel_)) + offset) & 0x1fffff;
+        return kx << 42 | ky << 21 | kz;
+    }
+
+    void fit(VoxelPlane &voxel) const
+    {
+        voxel.valid = false;
+        if (voxel.num < min_points_) return;
+        V3D mean = voxel.sum / voxel.num;
+        M3D cov = voxel.sum_sq / voxel.num - mean * mean.transpose();
+        Eigen::SelfAdjointEigenSolver<M3D> saes(cov);
+        V3D lambda = saes.eigenvalues();    // ascending
+        voxel.normal = saes.eigenvectors().col(0);
+        voxel.d = -voxel.normal.dot(mean);
+        voxel.sigma = sqrt(max(lambda(0), 0.0));
+        /*** thin across the normal, and spread along both in-plane directions rather than a line ***/
+        voxel.valid = voxel.sigma <= max_sigma_ && lambda(1) > max_sigma_ * max_sigma_;
+    }
+
+    unordered_map<uint64_t, VoxelPlane> voxels_;
+    vector<VoxelPlane *> touched_;
+    double inv_voxel_ = 2.0, max_sigma_ = 0.03;
+    int    min_points_ = NUM_MATCH_POINTS;
+    int    batch_ = 0;
+};
+
+#endif
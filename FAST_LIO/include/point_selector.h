@@ -0,0 +1,133 @@
+#ifndef POINT_SELECTOR_H
+#define POINT_SELECTOR_H
+
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <unordered_map>
+#include <common_lib.h>
+
+/*
+ * Budgeted selection of the scan points that best constrain the 6-DoF pose.
+ * Each point gets the plane normal the previous frame matched in its voxel, and with it the row of the
+ * point-to-plane Jacobian [p x n, n]: the rotation part grows with the lever arm p, the translation part is the
+ * normal itself. The budget is filled round-robin over the six pose directions, each time with the unselected point
+ * of largest |J_k|, so no direction is left weakly constrained. Points without a known normal keep their share of
+ * the budget and are spread evenly, so newly seen structure is still matched.
+ */
+class InformativeSelector
+{
+public:
+    void set_param(double normal_voxel)
+    {
+        inv_voxel_ = 1.0 / normal_voxel;
+    }
+
+    /*** remember the normals of the planes matched in the last update, world frame ***/
+    void update_normals(const PointType *world_points, const float *nx, const float *ny, const float *nz, const int *idx, int num)
+    {
+        normals_.clear();
+        for (int j = 0; j < num; j++)
+        {
+            const int i = idx[j];
+            const PointType &p = world_points[i];
+            normals_.emplace(key_of(p.x, p.y, p.z), Eigen::Vector3f(nx[i], ny[i], nz[i]));
+        }
+    }
+
+    /*
+    * @param points : n scan points in the LiDAR frame
+    * @param R, t   : predicted IMU pose in the world frame
+    * @param R_LI, T_LI : LiDAR to IMU extrinsic
+    * @param keep   : output, indices of the selected points in increasing order
+    */
+    void select(const PointType *points, int n, const M3D &R, const V3D &t, const M3D &R_LI, const V3D &T_LI,
+                int budget, vector<int> &keep)
+    {
+        keep.clear();
+        if (budget >= n)
+        {
+            for (int i = 0; i < n; i++) keep.push_back(i);
+            return;
+        }
+
+        jac_.clear();
+        known_.clear();
+        unknown_.clear();
+        for (int i = 0; i < n; i++)
+        {
+            V3D p_imu = R_LI * V3D(points[i].x, points[i].y, points[i].z) + T_LI;
+            V3D p_w = R * p_imu + t;
+            auto it = normals_.find(key_of(p_w(0), p_w(1), p_w(2)));
+            if (it == normals_.end())
+            {
+                unknown_.push_back(i);
+                continue;
+            }
+            V3D n_w = it->second.cast<double>();
+            V3D n_b = R.transpose() * n_w;
+            Eigen::Matrix<double, 6, 1> J;
+            J << p_imu.cross(n_b), n_w;
+            jac_.push_back(J.cwiseAbs().cast<float>());
+            known_.push_back(i);
+        }
+
+        /*** the unknown points keep their proportional share, spread evenly ***/
+        int unknown_budget = int((long)budget * unknown_.size() / n);
+        for (int j = 0; j < unknown_budget; j++) keep.push_back(unknown_[(long)j * unknown_.size() / unknown_budget]);
+
+        /*** round-robin over the pose directions, each with its points sorted by |J_k| ***/
+        const int m = known_.size();
+        int known_budget = min(budget - unknown_budget, m);
+        if (known_budget > 0)
+        {
+            const int per_dir = min(m, known_budget);
+            for (int k = 0; k < 6; k++)
+            {
+                vector<int> &order = order_[k];
+                order.resize(m);
+                for (int j = 0; j < m; j++) order[j] = j;
+                std::partial_sort(order.begin(), order.begin() + per_dir, order.end(),
+                                  [&](int a, int b) { return jac_[a](k) > jac_[b](k); });
+                cursor_[k] = 0;
+            }
+            taken_.assign(m, 0);
+            int picked = 0;
+            while (picked < known_budget)
+            {
+                bool progress = false;
+                for (int k = 0; k < 6 && picked < known_budget; k++)
+                {
+                    while (cursor_[k] < per_dir && taken_[order_[k][cursor_[k]]]) cursor_[k] ++;
+                    if (cursor_[k] >= per_dir) continue;
+                    int j = order_[k][cursor_[k] ++];
+                    taken_[j] = 1;
+                    keep.push_back(known_[j]);
+                    picked ++;
+                    progress = true;
+                }
+                if (!progress) break;
+            }
+        }
+        std::sort(keep.begin(), keep.end());
+    }
+
+private:
+    uint64_t key_of(double x, double y, double z) const
+    {
+        const int64_t offset = 1 << 20;
+        uint64_t kx = uint64_t(int64_t(floor(x * inv_voxel_)) + offset) & 0x1fffff;
+        uint64_t ky = uint64_t(int64_t(floor(y * inv_voxel_)) + offset) & 0x1fffff;
+        uint64_t kz = uint64_t(int64_t(floor(z * inv_voxel_)) + offset) & 0x1fffff;
+        return kx << 42 | ky << 21 | kz;
+    }
+
+    double inv_voxel_ = 1.0;
+    unordered_map<uint64_t, Eigen::Vector3f> normals_;
+    vector<Eigen::Matrix<float, 6, 1>> jac_;
+    vector<int> known_, unknown_, order_[6];
+    vector<uint8_t> taken_;
+    int cursor_[6];
+};
+
+#endif
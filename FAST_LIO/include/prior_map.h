@@ -0,0 +1,81 @@
+#ifndef PRIOR_MAP_H
+#define PRIOR_MAP_H
+
+#include <math.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <common_lib.h>
+#include <ikd-Tree/ikd_Tree.h>
+
+/*
+ * A prebuilt map held in memory as square x-y tiles, from which the local map cube is paged into the ikd-Tree.
+ * page() returns the points that enter the cube when it moves from old_box to new_box; the points leaving it are
+ * the ones lasermap_fov_segment already deletes, so the tree always holds the prior map clipped to the cube.
+ */
+class PriorMap
+{
+public:
+    void set_param(double tile_size)
+    {
+        tile_size_ = tile_size;
+    }
+
+    void set_points(const PointVector &points)
+    {
+        tiles_.clear();
+        for (const PointType &p : points) tiles_[key_of(p.x, p.y)].push_back(p);
+        point_num_ = points.size();
+    }
+
+    size_t size() const
+    {
+        return point_num_;
+    }
+
+    /*** append the points inside new_box and outside old_box (nullptr for the first page-in), returns their number ***/
+    int page(const BoxPointType *old_box, const BoxPointType &new_box, PointVector &points) const
+    {
+        int num = 0;
+        int64_t x_min = floor(new_box.vertex_min[0] / tile_size_), x_max = floor(new_box.vertex_max[0] / tile_size_);
+        int64_t y_min = floor(new_box.vertex_min[1] / tile_size_), y_max = floor(new_box.vertex_max[1] / tile_size_);
+        for (int64_t x = x_min; x <= x_max; x++)
+        {
+            for (int64_t y = y_min; y <= y_max; y++)
+            {
+                auto it = tiles_.find(key_of_tile(x, y));
+                if (it == tiles_.end()) continue;
+                for (const PointType &p : it->second)
+                {
+                    if (!in_box(p, new_box) || (old_box != nullptr && in_box(p, *old_box))) continue;
+                    points.push_back(p);
+                    num ++;
+                }
+            }
+        }
+        return num;
+    }
+
+private:
+    static bool in_box(const PointType &p, const BoxPointType &box)
+    {
+        return p.x >= box.vertex_min[0] && p.x < box.vertex_max[0] &&
+               p.y >= box.vertex_min[1] && p.y < box.vertex_max[1] &&
+               p.z >= box.vertex_min[2] && p.z < box.vertex_max[2];
+    }
+
+    uint64_t key_of_tile(int64_t x, int64_t y) const
+    {
+        return (uint64_t(x + (1LL << 31)) & 0xffffffff) << 32 | (uint64_t(y + (1LL << 31)) & 0xffffffff);
+    }
+
+    uint64_t key_of(double x, double y) const
+    {
+        return key_of_tile(floor(x / tile_size_), floor(y / tile_size_));
+    }
+
+    double tile_size_ = 20.0;
+    unordered_map<uint64_t, PointVector> tiles_;
+    size_t point_num_ = 0;
+};
+
+#endif
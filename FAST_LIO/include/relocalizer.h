@@ -0,0 +1,181 @@
+#ifndef RELOCALIZER_H
+#define RELOCALIZER_H
+
+#include <omp.h>
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <unordered_set>
+#include <common_lib.h>
+#include <so3_math.h>
+#include <ikd-Tree/ikd_Tree.h>
+
+struct RelocResult
+{
+    M3D    R = M3D::Identity();     // rotation applied to the leveled scan
+    V3D    t = V3D::Zero();
+    int    coarse_score = 0;        // scan voxels that hit occupied map voxels
+    double inlier_ratio = 0.0;      // share of fine scan points within inlier_dist of a map plane
+};
+
+/*
+ * Global relocalization of a scan in a prior map, around an initial guess.
+ * Coarse stage: exhaustive search over yaw and an x-y grid, scoring each candidate by how many voxels of the
+ * downsampled scan land on occupied voxels of a low-resolution copy of the map; candidates run in parallel.
+ * Fine stage: point-to-plane Gauss-Newton on the ikd-Tree map from the best coarse candidates, also in parallel.
+ * The scan is expected leveled, i.e. already rotated by the filter's roll and pitch, so only yaw is searched.
+ */
+class GlobalRelocalizer
+{
+public:
+    /*
+    * @param radius       : x-y search radius around the guess (m)
+    * @param step         : x-y grid step, also the voxel size of the coarse map (m)
+    * @param yaw_step     : yaw grid step (rad)
+    * @param fine_num     : coarse candidates refined by the fine stage
+    * @param thread_num   : threads for both stages, 0 for all cores
+    */
+    void set_param(double radius, double step, double yaw_step, int fine_num, int thread_num)
+    {
+        radius_ = radius;
+        step_ = step;
+        yaw_step_ = yaw_step;
+        fine_num_ = fine_num;
+        thread_num_ = thread_num > 0 ? thread_num : omp_get_num_procs();
+    }
+
+    /*** low-resolution occupancy of the map points around the search area ***/
+    void set_map(const PointVector &points)
+    {
+        occupied_.clear();
+        for (const PointType &p : points) occupied_.insert(key_of(V3D(p.x, p.y, p.z)));
+    }
+
+    /*
+    * @param scan  : leveled scan points, centered on the sensor
+    * @param guess : initial position in the map
+    * @param tree  : map used by the fine stage
+    */
+    RelocResult locate(const PointVector &scan, const V3D &guess, KD_TREE<PointType> &tree)
+    {
+        /*** one scan point per coarse voxel ***/
+        vector<V3D> coarse;
+        unordered_set<uint64_t> taken;
+        for (const PointType &p : scan)
+        {
+            V3D pt(p.x, p.y, p.z);
+            if (taken.insert(key_of(pt)).second) coarse.push_back(pt);
+        }
+
+        int yaw_num = max(1, int(ceil(2.0 * M_PI / yaw_step_)));
+        int grid_half = int(ceil(radius_ / step_));
+        int grid_side = 2 * grid_half + 1;
+        int cand_num = yaw_num * grid_side * grid_side;
+        vector<int> score(cand_num, 0);
+
+        vector<vector<V3D>> rotated(yaw_num);
+        for (int k = 0; k < yaw_num; k++)
+        {
+            M3D R = Eigen::AngleAxisd(k * yaw_step_, V3D::UnitZ()).toRotationMatrix();
+            rotated[k].reserve(coarse.size());
+            for (const V3D &p : coarse) rotated[k].push_back(R * p);
+        }
+
+        #pragma omp parallel for num_threads(thread_num_) schedule(dynamic, 16)
+        for (int c = 0; c < cand_num; c++)
+        {
+            int k = c / (grid_side * grid_side), cell = c % (grid_side * grid_side);
+            V3D t = guess + V3D((cell / grid_side - grid_half) * step_, (cell % grid_side - grid_half) * step_, 0.0);
+            if ((t - guess).head<2>().norm() > radius_) continue;
+            int hits = 0;
+            for (const V3D &p : rotated[k]) hits += occupied_.count(key_of(p + t));
+            score[c] = hits;
+        }
+
+        /*** best candidates, at most one per yaw so the fine stage sees different headings ***/
+        vector<int> best_per_yaw(yaw_num, -1);
+        for (int c = 0; c < cand_num; c++)
+        {
+            int k = c / (grid_side * grid_side);
+            if (best_per_yaw[k] < 0 || score[c] > score[best_per_yaw[k]]) best_per_yaw[k] = c;
+        }
+        std::sort(best_per_yaw.begin(), best_per_yaw.end(), [&](int a, int b) { return score[a] > score[b]; });
+        int fine_num = min(fine_num_, yaw_num);
+
+        vector<RelocResult> results(fine_num);
+        #pragma omp parallel for num_threads(min(thread_num_, fine_num)) schedule(dynamic, 1)
+        for (int j = 0; j < fine_num; j++)
+        {
+            int c = best_per_yaw[j], k = c / (grid_side * grid_side), cell = c % (grid_side * grid_side);
+            RelocResult &res = results[j];
+            res.R = Eigen::AngleAxisd(k * yaw_step_, V3D::UnitZ()).toRotationMatrix();
+            res.t = guess + V3D((cell / grid_side - grid_half) * step_, (cell % grid_side - grid_half) * step_, 0.0);
+            res.coarse_score = score[c];
+            refine(scan, tree, res);
+        }
+
+        RelocResult best;
+        for (const RelocResult &res : results)
+        {
+            if (res.inlier_ratio > best.inlier_ratio) best = res;
+        }
+        return best;
+    }
+
+private:
+    /*** point-to-plane Gauss-Newton from res, with a shrinking correspondence gate ***/
+    void refine(const PointVector &scan, KD_TREE<PointType> &tree, RelocResult &res) const
+    {
+        const double inlier_dist = 0.1;
+        PointVector nearest;
+        vector<float> nearest_dis;
+        double gate = step_;
+        for (int iter = 0; iter < max_iter_; iter++)
+        {
+            Eigen::Matrix<double, 6, 6> H = Eigen::Matrix<double, 6, 6>::Zero();
+            Eigen::Matrix<double, 6, 1> b = Eigen::Matrix<double, 6, 1>::Zero();
+            int inliers = 0;
+            for (const PointType &p : scan)
+            {
+                V3D pw = res.R * V3D(p.x, p.y, p.z) + res.t;
+                PointType q;
+                q.x = pw(0); q.y = pw(1); q.z = pw(2);
+                tree.Nearest_Search(q, NUM_MATCH_POINTS, nearest, nearest_dis);
+                if (int(nearest.size()) < NUM_MATCH_POINTS || nearest_dis.back() > 5) continue;
+                Eigen::Matrix<double, 4, 1> abcd;
+                if (!esti_plane(abcd, nearest, 0.1)) continue;
+                V3D n = abcd.head<3>();
+                double r = n.dot(pw) + abcd(3);
+                if (fabs(r) > gate) continue;
+                if (fabs(r) < inlier_dist) inliers ++;
+                Eigen::Matrix<double, 6, 1> J;
+                J << pw.cross(n), n;
+                H += J * J.transpose();
+                b += J * r;
+            }
+            res.inlier_ratio = scan.empty() ? 0.0 : double(inliers) / scan.size();
+            if (H.trace() < 1e-6 || iter == max_iter_ - 1) break;
+            Eigen::Matrix<double, 6, 1> dx = -(H + 1e-6 * Eigen::Matrix<double, 6, 6>::Identity()).ldlt().solve(b);
+            M3D dR = Exp(V3D(dx.head<3>()), 1.0);
+            res.R = dR * res.R;
+            res.t = dR * res.t + dx.tail<3>();
+            gate = max(0.5 * gate, 2.0 * inlier_dist);
+            if (dx.norm() < 1e-4) break;
+        }
+    }
+
+    uint64_t key_of(const V3D &p) const
+    {
+        const int64_t offset = 1 << 20;
+        uint64_t kx = uint64_t(int64_t(floor(p(0) / step_)) + offset) & 0x1fffff;
+        uint64_t ky = uint64_t(int64_t(floor(p(1) / step_)) + offset) & 0x1fffff;
+        uint64_t kz = uint64_t(int64_t(floor(p(2) / step_)) + offset) & 0x1fffff;
+        return kx << 42 | ky << 21 | kz;
+    }
+
+    unordered_set<uint64_t> occupied_;
+    double radius_ = 20.0, step_ = 1.0, yaw_step_ = 10.0 * M_PI / 180.0;
+    int    fine_num_ = 8, thread_num_ = 1, max_iter_ = 20;
+};
+
+#endif
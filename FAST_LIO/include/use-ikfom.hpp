@@ -20,6 +20,16 @@ MTK_BUILD_MANIFOLD(state_ikfom,
 ((S2, grav))
 );
 
+// state_ikfom without the IMU-LiDAR extrinsic, for a calibration that is not estimated online (17 DoF)
+MTK_BUILD_MANIFOLD(state_ikfom_fixed,
+((vect3, pos))
+((SO3, rot))
+((vect3, vel))
+((vect3, bg))
+((vect3, ba))
+((S2, grav))
+);
+
 MTK_BUILD_MANIFOLD(input_ikfom,
 ((vect3, acc))
 ((vect3, gyro))
@@ -42,51 +52,175 @@ MTK::get_cov<process_noise_ikfom>::type process_noise_cov()
 	return cov;
 }
 
+// IMU-LiDAR extrinsic used by state_ikfom_fixed, which does not carry it as states
+SO3   fixed_offset_R_L_I;
+vect3 fixed_offset_T_L_I;
+
+const SO3 &offset_R_L_I(const state_ikfom &s) {return s.offset_R_L_I;}
+const vect3 &offset_T_L_I(const state_ikfom &s) {return s.offset_T_L_I;}
+const SO3 &offset_R_L_I(const state_ikfom_fixed &s) {return fixed_offset_R_L_I;}
+const vect3 &offset_T_L_I(const state_ikfom_fixed &s) {return fixed_offset_T_L_I;}
+
+void set_offset(state_ikfom &s, const Eigen::Matrix3d &R, const Eigen::Vector3d &T)
+{
+	s.offset_R_L_I = R;
+	s.offset_T_L_I = T;
+}
+
+void set_offset(state_ikfom_fixed &s, const Eigen::Matrix3d &R, const Eigen::Vector3d &T)
+{
+	fixed_offset_R_L_I = R;
+	fixed_offset_T_L_I = T;
+}
+
+state_ikfom to_state_ikfom(const state_ikfom &s)
+{
+	return s;
+}
+
+state_ikfom to_state_ikfom(const state_ikfom_fixed &s)
+{
+	state_ikfom res;
+	res.pos = s.pos;
+	res.rot = s.rot;
+	res.offset_R_L_I = fixed_offset_R_L_I;
+	res.offset_T_L_I = fixed_offset_T_L_I;
+	res.vel = s.vel;
+	res.bg = s.bg;
+	res.ba = s.ba;
+	res.grav = s.grav;
+	return res;
+}
+
+void from_state_ikfom(const state_ikfom &full, state_ikfom &s)
+{
+	s = full;
+}
+
+void from_state_ikfom(const state_ikfom &full, state_ikfom_fixed &s)
+{
+	s.pos = full.pos;
+	s.rot = full.rot;
+	s.vel = full.vel;
+	s.bg = full.bg;
+	s.ba = full.ba;
+	s.grav = full.grav;
+}
+
+// number of leading state dimensions the point-to-plane measurement depends on
+template<typename S> struct lidar_meas_dof;
+template<> struct lidar_meas_dof<state_ikfom>       {enum {value = 12};};
+template<> struct lidar_meas_dof<state_ikfom_fixed> {enum {value = 6};};
+
+// initial covariance: unit for pos, rot and vel, small for the extrinsic, biases and gravity
+template<typename S>
+void init_cov_ikfom(Eigen::Matrix<double, S::DOF, S::DOF> &P)
+{
+	P.setIdentity();
+	P.template block<3, 3>(decltype(S::bg)::IDX, decltype(S::bg)::IDX).diagonal().setConstant(0.0001);
+	P.template block<3, 3>(decltype(S::ba)::IDX, decltype(S::ba)::IDX).diagonal().setConstant(0.001);
+	P.template block<2, 2>(decltype(S::grav)::IDX, decltype(S::grav)::IDX).diagonal().setConstant(0.00001);
+}
+
+void init_cov_ikfom(Eigen::Matrix<double, state_ikfom::DOF, state_ikfom::DOF> &P)
+{
+	init_cov_ikfom<state_ikfom>(P);
+	P(6,6) = P(7,7) = P(8,8) = 0.00001;
+	P(9,9) = P(10,10) = P(11,11) = 0.00001;
+}
+
+void init_cov_ikfom(Eigen::Matrix<double, state_ikfom_fixed::DOF, state_ikfom_fixed::DOF> &P)
+{
+	init_cov_ikfom<state_ikfom_fixed>(P);
+}
+
+// The process model is written once for both state layouts: rows index the flatted state (DIM offsets
+// of the sub-manifolds) and columns the error state (IDX offsets).
 //double L_offset_to_I[3] = {0.04165, 0.02326, -0.0284}; // Avia 
 //vect3 Lidar_offset_to_IMU(L_offset_to_I, 3);
-Eigen::Matrix<double, 24, 1> get_f(state_ikfom &s, const input_ikfom &in)
+template<typename S>
+Eigen::Matrix<double, S::DIM, 1> get_f(S &s, const input_ikfom &in)
 {
-	Eigen::Matrix<double, 24, 1> res = Eigen::Matrix<double, 24, 1>::Zero();
+	Eigen::Matrix<double, S::DIM, 1> res = Eigen::Matrix<double, S::DIM, 1>::Zero();
 	vect3 omega;
 	in.gyro.boxminus(omega, s.bg);
 	vect3 a_inertial = s.rot * (in.acc-s.ba); 
 	for(int i = 0; i < 3; i++ ){
-		res(i) = s.vel[i];
-		res(i + 3) =  omega[i]; 
-		res(i + 12) = a_inertial[i] + s.grav[i]; 
+		res(i + decltype(s.pos)::DIM) = s.vel[i];
+		res(i + decltype(s.rot)::DIM) =  omega[i]; 
+		res(i + decltype(s.vel)::DIM) = a_inertial[i] + s.grav[i]; 
 	}
 	return res;
 }
 
-Eigen::Matrix<double, 24, 23> df_dx(state_ikfom &s, const input_ikfom &in)
+template<typename S>
+Eigen::Matrix<double, S::DIM, S::DOF> df_dx(S &s, const input_ikfom &in)
 {
-	Eigen::Matrix<double, 24, 23> cov = Eigen::Matrix<double, 24, 23>::Zero();
-	cov.template block<3, 3>(0, 12) = Eigen::Matrix3d::Identity();
+	enum {pos = decltype(s.pos)::DIM, rot = decltype(s.rot)::DIM, vel = decltype(s.vel)::DIM,
+		  vel_ = decltype(s.vel)::IDX, bg_ = decltype(s.bg)::IDX, ba_ = decltype(s.ba)::IDX, rot_ = decltype(s.rot)::IDX, grav_ = decltype(s.grav)::IDX};
+	Eigen::Matrix<double, S::DIM, S::DOF> cov = Eigen::Matrix<double, S::DIM, S::DOF>::Zero();
+	cov.template block<3, 3>(pos, vel_) = Eigen::Matrix3d::Identity();
 	vect3 acc_;
 	in.acc.boxminus(acc_, s.ba);
 	vect3 omega;
 	in.gyro.boxminus(omega, s.bg);
-	cov.template block<3, 3>(12, 3) = -s.rot.toRotationMatrix()*MTK::hat(acc_);
-	cov.template block<3, 3>(12, 18) = -s.rot.toRotationMatrix();
-	Eigen::Matrix<state_ikfom::scalar, 2, 1> vec = Eigen::Matrix<state_ikfom::scalar, 2, 1>::Zero();
-	Eigen::Matrix<state_ikfom::scalar, 3, 2> grav_matrix;
-	s.S2_Mx(grav_matrix, vec, 21);
-	cov.template block<3, 2>(12, 21) =  grav_matrix; 
-	cov.template block<3, 3>(3, 15) = -Eigen::Matrix3d::Identity(); 
+	cov.template block<3, 3>(vel, rot_) = -s.rot.toRotationMatrix()*MTK::hat(acc_);
+	cov.template block<3, 3>(vel, ba_) = -s.rot.toRotationMatrix();
+	Eigen::Matrix<typename S::scalar, 2, 1> vec = Eigen::Matrix<typename S::scalar, 2, 1>::Zero();
+	Eigen::Matrix<typename S::scalar, 3, 2> grav_matrix;
+	s.S2_Mx(grav_matrix, vec, grav_);
+	cov.template block<3, 2>(vel, grav_) =  grav_matrix; 
+	cov.template block<3, 3>(rot, bg_) = -Eigen::Matrix3d::Identity(); 
 	return cov;
 }
 
 
-Eigen::Matrix<double, 24, 12> df_dw(state_ikfom &s, const input_ikfom &in)
+template<typename S>
+Eigen::Matrix<double, S::DIM, 12> df_dw(S &s, const input_ikfom &in)
 {
-	Eigen::Matrix<double, 24, 12> cov = Eigen::Matrix<double, 24, 12>::Zero();
-	cov.template block<3, 3>(12, 3) = -s.rot.toRotationMatrix();
-	cov.template block<3, 3>(3, 0) = -Eigen::Matrix3d::Identity();
-	cov.template block<3, 3>(15, 6) = Eigen::Matrix3d::Identity();
-	cov.template block<3, 3>(18, 9) = Eigen::Matrix3d::Identity();
+	Eigen::Matrix<double, S::DIM, 12> cov = Eigen::Matrix<double, S::DIM, 12>::Zero();
+	cov.template block<3, 3>(decltype(s.vel)::DIM, 3) = -s.rot.toRotationMatrix();
+	cov.template block<3, 3>(decltype(s.rot)::DIM, 0) = -Eigen::Matrix3d::Identity();
+	cov.template block<3, 3>(decltype(s.bg)::DIM, 6) = Eigen::Matrix3d::Identity();
+	cov.template block<3, 3>(decltype(s.ba)::DIM, 9) = Eigen::Matrix3d::Identity();
 	return cov;
 }
 
+// M = F * M for a discrete transition F built from df_dx. Apart from the identity, F only has
+// the pos-vel, rot-rot, rot-bg, vel-rot, vel-ba, vel-grav and grav-grav blocks, so only the
+// rows of pos, rot, vel and grav change.
+template<typename S>
+void df_dx_mul(const Eigen::Matrix<double, S::DOF, S::DOF> &F, Eigen::Matrix<double, S::DOF, S::DOF> &M)
+{
+	enum {n = S::DOF, pos = decltype(S::pos)::IDX, rot = decltype(S::rot)::IDX, vel = decltype(S::vel)::IDX,
+		  bg = decltype(S::bg)::IDX, ba = decltype(S::ba)::IDX, grav = decltype(S::grav)::IDX};
+	Eigen::Matrix<double, 3, n> pos_row = M.template block<3, n>(pos, 0) + F.template block<3, 3>(pos, vel) * M.template block<3, n>(vel, 0);
+	Eigen::Matrix<double, 3, n> rot_row = F.template block<3, 3>(rot, rot) * M.template block<3, n>(rot, 0) + F.template block<3, 3>(rot, bg) * M.template block<3, n>(bg, 0);
+	Eigen::Matrix<double, 3, n> vel_row = M.template block<3, n>(vel, 0) + F.template block<3, 3>(vel, rot) * M.template block<3, n>(rot, 0)
+										+ F.template block<3, 3>(vel, ba) * M.template block<3, n>(ba, 0) + F.template block<3, 2>(vel, grav) * M.template block<2, n>(grav, 0);
+	Eigen::Matrix<double, 2, n> grav_row = F.template block<2, 2>(grav, grav) * M.template block<2, n>(grav, 0);
+	M.template block<3, n>(pos, 0) = pos_row;
+	M.template block<3, n>(rot, 0) = rot_row;
+	M.template block<3, n>(vel, 0) = vel_row;
+	M.template block<2, n>(grav, 0) = grav_row;
+}
+
+// P += G * Q * G^T for a discrete noise Jacobian G built from df_dw, which maps ng, na, nbg, nba
+// to rot, vel, bg and ba respectively.
+template<typename S>
+void df_dw_cov(const Eigen::Matrix<double, S::DOF, 12> &G, const Eigen::Matrix<double, 12, 12> &Q, Eigen::Matrix<double, S::DOF, S::DOF> &P)
+{
+	const int idx[4] = {decltype(S::rot)::IDX, decltype(S::vel)::IDX, decltype(S::bg)::IDX, decltype(S::ba)::IDX};
+	for(int a = 0; a < 4; a++)
+	{
+		Eigen::Matrix<double, 3, 12> GQ = G.template block<3, 3>(idx[a], 3 * a) * Q.template block<3, 12>(3 * a, 0);
+		for(int b = 0; b < 4; b++)
+		{
+			P.template block<3, 3>(idx[a], idx[b]) += GQ.template block<3, 3>(0, 3 * b) * G.template block<3, 3>(idx[b], 3 * b).transpose();
+		}
+	}
+}
+
 vect3 SO3ToEuler(const SO3 &orient) 
 {
 	Eigen::Matrix<double, 3, 1> _ang;
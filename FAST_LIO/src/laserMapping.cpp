@@ -67,6 +67,15 @@
 #include <geometry_msgs/msg/vector3.hpp>
 #include "preprocess.h"
 #include <ikd-Tree/ikd_Tree.h>
+#include <knn_batch.h>
+#include <plane_cache.h>
+#include <fov_culler.h>
+#include <map_tiles.h>
+#include <map_snapshot.h>
+#include <prior_map.h>
+#include <relocalizer.h>
+#include <point_selector.h>
+#include <lidar_merger.h>
 #include <pcl/common/transforms.h>  
 #include <pcl/kdtree/kdtree_flann.h>
 
@@ -75,6 +84,7 @@
 #include <Eigen/Geometry>
 
 #include "std_msgs/msg/u_int32.hpp"
+#include "std_msgs/msg/float32.hpp"
 
 #include <map>
 #include <unordered_map>
@@ -91,9 +101,30 @@ double match_time = 0, solve_time = 0, solve_const_H_time = 0;
 int    kdtree_size_st = 0, kdtree_size_end = 0, add_point_size = 0, kdtree_delete_counter = 0;
 bool   runtime_pos_log = false, pcd_save_en = false, time_sync_en = false, extrinsic_est_en = true, path_en = true;
 bool   traj_save_en = false;
+
+/*** deadline-aware update budget ***/
+bool   deadline_en = false;
+double deadline_ratio = 0.9;                  // share of the scan period a frame may take
+int    deadline_min_points = 500;             // point budget floor under load
+double scan_period = 0.1, last_scan_beg_time = -1.0;
+double update_cost_per_pt = 0.0;              // running average, seconds per point and filter iteration
+const int deadline_window = 100;                // frames the published miss rate is taken over
+deque<uint8_t> deadline_misses;                 // 1 for each of the last frames that missed its deadline
+int    deadline_miss_num = 0;                   // misses in deadline_misses
+
+/*** input queue bounds ***/
+enum QUEUE_POLICY{DROP_OLDEST = 0, DROP_TO_LATEST, MERGE_SCANS};
+int    max_lidar_queue = 0, max_imu_queue = 0;  // 0: unbounded
+int    lidar_queue_policy = DROP_OLDEST;
+int    lidar_drop_num = 0;
+
+/*** sub-sweeps: each scan is split by point time into sub_sweep_num frames, registered one by one for a finer pose output ***/
+int    sub_sweep_num = 1;
+
+/*** Livox CustomMsg input, with the driver's per-point offset times ***/
+bool   livox_custom_msg = false;
 /**************************/
 
-float res_last[100000] = {0.0};
 float DET_RANGE = 300.0f;
 const float MOV_THRESHOLD = 1.5f;
 double time_diff_lidar_to_imu = 0.0;
@@ -111,8 +142,7 @@ double gyr_cov = 0.1, acc_cov = 0.1, b_gyr_cov = 0.0001, b_acc_cov = 0.0001;
 double filter_size_surf_min = 0, filter_size_map_min = 0, fov_deg = 0;
 double cube_len = 0, HALF_FOV_COS = 0, FOV_DEG = 0, total_distance = 0, lidar_end_time = 0, first_lidar_time = 0.0;
 int    effct_feat_num = 0, time_log_counter = 0, scan_count = 0, publish_count = 0;
-int    iterCount = 0, feats_down_size = 0, NUM_MAX_ITERATIONS = 0, laserCloudValidNum = 0, pcd_save_interval = -1, pcd_index = 0;
-bool   point_selected_surf[100000] = {0};
+int    iterCount = 0, feats_down_size = 0, feats_match_size = 0, NUM_MAX_ITERATIONS = 0, laserCloudValidNum = 0, pcd_save_interval = -1, pcd_index = 0;
 bool   lidar_pushed, flg_first_scan = true, flg_exit = false, flg_EKF_inited;
 bool   scan_pub_en = false, dense_pub_en = false, scan_body_pub_en = false, fusion_pub_en = false;
 bool    is_first_lidar = true;
@@ -133,7 +163,78 @@ string odom_frame_id, base_frame_id, lidar_frame_id, keyframe_topic, keyframe_id
 
 vector<vector<int>>  pointSearchInd_surf; 
 vector<BoxPointType> cub_needrm;
-vector<PointVector>  Nearest_Points; 
+/*** neighbors of feats_down_body[i]: nearest_flat[i * NUM_MATCH_POINTS ...], nearest_num[i] of them ***/
+PointVector          nearest_flat;
+vector<int>          nearest_num;
+vector<float>        nearest_kth_dis;     // squared distance of the farthest neighbor
+KnnBatch             knn_batch;
+
+/*** per-voxel plane cache of the map ***/
+bool                 plane_cache_en = false;
+double               plane_cache_voxel = 0.5, plane_cache_sigma = 0.03;
+VoxelPlaneCache      plane_cache;
+vector<const VoxelPlane *> cached_plane;  // plane of the voxel each point falls in, nullptr if none
+vector<uint8_t>      search_skip;          // 1 for points left out of the kNN search: cached plane, or not on the coarse level
+
+/*** keep only the part of the local map inside the LiDAR view cone in the kdtree ***/
+bool                 fov_cull_en = false;
+double               fov_cull_block = 10.0;
+FovMapCuller         fov_culler;
+int                  fov_cull_moved = 0;
+
+/*** map points leaving the local cube are kept in on-disk tiles and reloaded when the cube returns ***/
+bool                 map_tile_en = false;
+double               map_tile_size = 20.0;
+string               map_tile_dir;
+MapTileStore         map_tiles;
+PointVector          map_tile_io;
+int                  map_tile_saved = 0, map_tile_loaded = 0;
+
+/*** binary snapshot of the map and state, to restart from ***/
+bool                 snapshot_load_en = false, snapshot_save_en = false;
+double               snapshot_interval = 0.0, last_snapshot_time = -1.0;
+string               snapshot_path;
+bool                 snapshot_pose_pending = false;   // restore the snapshot pose once the IMU is initialized
+state_ikfom          snapshot_state;
+MapSnapshotWriter    snapshot_writer;
+
+/*** localization against a prebuilt map: the prior map is paged into the kdtree instead of mapping ***/
+bool                 localization_en = false, dynamic_layer_en = false;
+double               prior_map_tile = 20.0, dynamic_layer_time = 5.0;
+string               prior_map_path;
+vector<double>       init_pose(4, 0.0);            // x, y, z, yaw (deg) of the start in the prior map
+bool                 init_pose_pending = false;
+PriorMap             prior_map;
+int                  prior_map_paged = 0;
+deque<pair<double, PointVector>> dynamic_layer;    // scan points inserted on top of the prior map, by time
+
+/*** information-driven selection of a fixed number of points of feats_down_body to match ***/
+bool                 point_select_en = false;
+int                  point_select_num = 1000;
+double               point_select_voxel = 1.0;
+InformativeSelector  point_selector;
+vector<int>          point_select_keep;
+
+/*** coarse-to-fine registration: until the update first converges, only a coarse subset of the scan is matched ***/
+bool                 pyramid_en = false, pyramid_coarse = false;
+double               pyramid_leaf = 2.0;
+vector<uint8_t>      coarse_skip;          // 1 for points outside the coarse subset
+int                  h_model_calls = 0, kf_max_iter = 0;
+
+/*** zero-velocity detection: while stationary, no map insertion, and one measurement evaluation on reused neighbors plus a zero-velocity update ***/
+bool                 stationary_en = false, stationary = false;
+double               stationary_acc_ratio = 0.01, stationary_gyr = 0.02, stationary_vel = 0.1, stationary_vel_std = 0.01;
+int                  stationary_frames = 5, stationary_count = 0;
+/*** neighbors found by the last searched still frame, by world voxel of the query; the map does not change while stationary ***/
+unordered_map<uint64_t, int> still_nbr_slot;      // voxel -> still_nbr_points[slot * NUM_MATCH_POINTS ...]
+PointVector          still_nbr_points;
+vector<float>        still_nbr_kth_dis;
+
+/*** global relocalization of the first scan in the prior map ***/
+bool                 reloc_en = false, reloc_pending = false;
+double               reloc_radius = 20.0, reloc_step = 1.0, reloc_yaw_step = 10.0, reloc_min_inlier = 0.3;
+int                  reloc_fine_num = 8, reloc_threads = 0;
+GlobalRelocalizer    relocalizer;
 vector<double>       extrinT(3, 0.0);
 vector<double>       extrinR(9, 0.0);
 deque<double>                     time_buffer;
@@ -147,11 +248,27 @@ bool debug_print;
 
 PointCloudXYZI::Ptr featsFromMap(new PointCloudXYZI());
 PointCloudXYZI::Ptr feats_undistort(new PointCloudXYZI());
+/*** the first feats_match_size points of feats_down_body are matched and drive the update, all of them go to the map ***/
 PointCloudXYZI::Ptr feats_down_body(new PointCloudXYZI());
 PointCloudXYZI::Ptr feats_down_world(new PointCloudXYZI());
-PointCloudXYZI::Ptr normvec(new PointCloudXYZI(100000, 1));
-PointCloudXYZI::Ptr laserCloudOri(new PointCloudXYZI(100000, 1));
-PointCloudXYZI::Ptr corr_normvect(new PointCloudXYZI(100000, 1));
+PointCloudXYZI::Ptr laserCloudOri(new PointCloudXYZI());
+
+/*** per-point plane matches of the current frame, grown to feats_down_size ***/
+struct PlaneMatches
+{
+    vector<float>   nx, ny, nz, pd2;   // plane normal and signed point-to-plane distance
+    vector<float>   res;               // |pd2|
+    vector<uint8_t> selected;          // not vector<bool>: elements are written from several threads
+
+    void resize(int n)
+    {
+        nx.resize(n); ny.resize(n); nz.resize(n); pd2.resize(n);
+        res.resize(n);
+        selected.resize(n, true);
+    }
+};
+PlaneMatches plane_matches;
+vector<int>  effct_idx;                // plane_matches index of each effective feature
 PointCloudXYZI::Ptr _featsArray;
 
 pcl::VoxelGrid<PointType> downSizeFilterSurf;
@@ -169,6 +286,7 @@ M3D Lidar_R_wrt_IMU(Eye3d);
 /*** EKF inputs and output ***/
 MeasureGroup Measures;
 esekfom::esekf<state_ikfom, 12, input_ikfom> kf;
+esekfom::esekf<state_ikfom_fixed, 12, input_ikfom> kf_fixed; // used instead of kf when the extrinsic is not estimated
 state_ikfom state_point;
 vect3 pos_lid;
 
@@ -179,6 +297,13 @@ geometry_msgs::msg::PoseStamped msg_body_pose, msg_body_pose_updated;
 shared_ptr<Preprocess> p_pre(new Preprocess());
 shared_ptr<ImuProcess> p_imu(new ImuProcess());
 
+/*** multi-LiDAR: the scans of the extra LiDARs are merged into the scans of the primary one (lid_topic) ***/
+int    extra_lidar_num = 0;
+vector<string>                 extra_lid_topics;
+vector<shared_ptr<Preprocess>> lidar_pre;       // per LiDAR, lidar_pre[0] is p_pre
+vector<deque<pair<sensor_msgs::msg::PointCloud2::UniquePtr, double>>> lidar_raw;   // per LiDAR, scans waiting for preprocessing
+LidarMerger lidar_merger;
+
 
 /*** Maintain keyframe mechanism ***/
 // cache historical lidar frames, and determine which frame is a key frame based on the subscribed sequence
@@ -294,6 +419,37 @@ void points_cache_collect()
 
 BoxPointType LocalMap_Points;
 bool Localmap_Initialized = false;
+
+/*** add the prior map points that entered the local map cube since old_box ***/
+void prior_map_page(const BoxPointType *old_box)
+{
+    PointVector points;
+    prior_map_paged = prior_map.page(old_box, LocalMap_Points, points);
+    if (points.empty()) return;
+    if (ikdtree.Root_Node == nullptr)
+    {
+        ikdtree.set_downsample_param(filter_size_map_min);
+        ikdtree.Build(points);
+    }
+    else ikdtree.Add_Points(points, false);
+    if (plane_cache_en) plane_cache.add_points(points);
+    if (fov_cull_en) fov_culler.add_points(points);
+}
+
+/*** distance the local map cube moves when the LiDAR nears its edge ***/
+float cube_move_dist()
+{
+    return max((cube_len - 2.0 * MOV_THRESHOLD * DET_RANGE) * 0.5 * 0.9, double(DET_RANGE * (MOV_THRESHOLD -1)));
+}
+
+/*** bounds included, as in Box_Search ***/
+bool point_in_box(const PointType &p, const BoxPointType &box)
+{
+    return p.x >= box.vertex_min[0] && p.x <= box.vertex_max[0] &&
+           p.y >= box.vertex_min[1] && p.y <= box.vertex_max[1] &&
+           p.z >= box.vertex_min[2] && p.z <= box.vertex_max[2];
+}
+
 void lasermap_fov_segment()
 {
     cub_needrm.clear();
@@ -307,6 +463,7 @@ void lasermap_fov_segment()
             LocalMap_Points.vertex_max[i] = pos_LiD(i) + cube_len / 2.0;
         }
         Localmap_Initialized = true;
+        if (localization_en) prior_map_page(nullptr);
         return;
     }
     float dist_to_map_edge[3][2];
@@ -317,9 +474,9 @@ void lasermap_fov_segment()
         if (dist_to_map_edge[i][0] <= MOV_THRESHOLD * DET_RANGE || dist_to_map_edge[i][1] <= MOV_THRESHOLD * DET_RANGE) need_move = true;
     }
     if (!need_move) return;
-    BoxPointType New_LocalMap_Points, tmp_boxpoints;
+    BoxPointType New_LocalMap_Points, tmp_boxpoints, Old_LocalMap_Points = LocalMap_Points;
     New_LocalMap_Points = LocalMap_Points;
-    float mov_dist = max((cube_len - 2.0 * MOV_THRESHOLD * DET_RANGE) * 0.5 * 0.9, double(DET_RANGE * (MOV_THRESHOLD -1)));
+    float mov_dist = cube_move_dist();
     for (int i = 0; i < 3; i++){
         tmp_boxpoints = LocalMap_Points;
         if (dist_to_map_edge[i][0] <= MOV_THRESHOLD * DET_RANGE){
@@ -338,10 +495,244 @@ void lasermap_fov_segment()
 
     points_cache_collect();
     double delete_begin = omp_get_wtime();
+    map_tile_saved = map_tile_loaded = 0;
+    if (map_tile_en)
+    {
+        /*** the removed slabs are deleted lazily inside the tree, so fetch their points before deleting; slabs of a
+             move along several axes share their corners, whose points are taken from the first slab only ***/
+        map_tile_io.clear();
+        for (size_t k = 0; k < cub_needrm.size(); k++)
+        {
+            PointVector box_points;
+            ikdtree.Box_Search(cub_needrm[k], box_points);
+            for (const PointType &p : box_points)
+            {
+                bool taken = false;
+                for (size_t j = 0; j < k && !taken; j++) taken = point_in_box(p, cub_needrm[j]);
+                if (!taken) map_tile_io.push_back(p);
+            }
+        }
+    }
     if(cub_needrm.size() > 0) kdtree_delete_counter = ikdtree.Delete_Point_Boxes(cub_needrm);
+    if(plane_cache_en && cub_needrm.size() > 0) plane_cache.remove_boxes(cub_needrm);
+    if(fov_cull_en && cub_needrm.size() > 0) fov_culler.remove_boxes(cub_needrm, map_tile_en ? &map_tile_io : nullptr);
+    if (map_tile_en)
+    {
+        map_tile_saved = map_tiles.save(map_tile_io);
+        map_tile_io.clear();
+        map_tile_loaded = map_tiles.load(LocalMap_Points, map_tile_io);
+        if (!map_tile_io.empty())
+        {
+            ikdtree.Add_Points(map_tile_io, false);
+            if (plane_cache_en) plane_cache.add_points(map_tile_io);
+            if (fov_cull_en) fov_culler.add_points(map_tile_io);
+        }
+    }
+    if (localization_en) prior_map_page(&Old_LocalMap_Points);
     kdtree_delete_time = omp_get_wtime() - delete_begin;
 }
 
+/*** read the tiles the next cube move can reach in the background, and write back the ones it left far behind ***/
+void map_tile_prefetch()
+{
+    if (!map_tile_en || !Localmap_Initialized) return;
+    BoxPointType box = LocalMap_Points;
+    float mov_dist = cube_move_dist();
+    for (int i = 0; i < 2; i++)
+    {
+        box.vertex_min[i] -= mov_dist;
+        box.vertex_max[i] += mov_dist;
+    }
+    map_tiles.prefetch(box);
+}
+
+/*** park the map blocks outside the view cone, restore the ones back inside ***/
+void lasermap_fov_cull()
+{
+    fov_cull_moved = 0;
+    if (!fov_cull_en || !Localmap_Initialized) return;
+    V3D pos_LiD = pos_lid;
+    V3D axis = XAxisPoint_world.cast<double>() - pos_LiD;
+    if (axis.norm() < 1e-6) return;
+    fov_cull_moved = fov_culler.update(ikdtree, pos_LiD, axis.normalized());
+}
+
+/*** access to whichever filter is active, always through the full state ***/
+state_ikfom kf_get_x()
+{
+    if (extrinsic_est_en) return kf.get_x();
+    return to_state_ikfom(kf_fixed.get_x());
+}
+
+void kf_change_x(state_ikfom &s)
+{
+    if (extrinsic_est_en)
+    {
+        kf.change_x(s);
+        return;
+    }
+    state_ikfom_fixed s_fixed;
+    from_state_ikfom(s, s_fixed);
+    kf_fixed.change_x(s_fixed);
+}
+
+// pos and rot lead both state layouts
+Eigen::Matrix<double, 6, 6> kf_pose_cov()
+{
+    if (extrinsic_est_en) return kf.get_P().block<6, 6>(0, 0);
+    return kf_fixed.get_P().block<6, 6>(0, 0);
+}
+
+void kf_reset_cov()
+{
+    if (extrinsic_est_en)
+    {
+        esekfom::esekf<state_ikfom, 12, input_ikfom>::cov P = kf.get_P();
+        init_cov_ikfom(P);
+        kf.change_P(P);
+        return;
+    }
+    esekfom::esekf<state_ikfom_fixed, 12, input_ikfom>::cov P = kf_fixed.get_P();
+    init_cov_ikfom(P);
+    kf_fixed.change_P(P);
+}
+
+/*** Kalman update with the pseudo-measurement vel = 0 of standard deviation vel_std ***/
+template<typename S>
+void zero_velocity_update(esekfom::esekf<S, 12, input_ikfom> &kf_state, double vel_std)
+{
+    enum {n = S::DOF, vel = decltype(S::vel)::IDX};
+    S x = kf_state.get_x();
+    typename esekfom::esekf<S, 12, input_ikfom>::cov P = kf_state.get_P();
+    M3D S_inv = (P.template block<3, 3>(vel, vel) + vel_std * vel_std * M3D::Identity()).inverse();
+    Eigen::Matrix<double, n, 3> K = P.template block<n, 3>(0, vel) * S_inv;
+    Eigen::Matrix<double, n, 1> dx = K * (-V3D(x.vel));
+    x.boxplus(dx);
+    P = P - K * P.template block<3, n>(vel, 0);
+    kf_state.change_x(x);
+    kf_state.change_P(P);
+}
+
+void kf_zero_velocity_update(double vel_std)
+{
+    if (extrinsic_est_en) zero_velocity_update(kf, vel_std);
+    else zero_velocity_update(kf_fixed, vel_std);
+}
+
+/*** still when the accelerometer norm barely varies, the gyro is quiet and the filter is slow, for stationary_frames frames in a row ***/
+bool detect_stationary(const MeasureGroup &meas, const V3D &vel)
+{
+    int n = meas.imu.size();
+    double acc_sum = 0.0, acc_sq_sum = 0.0, gyr_sum = 0.0;
+    for (const auto &imu : meas.imu)
+    {
+        double acc = V3D(imu->linear_acceleration.x, imu->linear_acceleration.y, imu->linear_acceleration.z).norm();
+        acc_sum += acc;
+        acc_sq_sum += acc * acc;
+        gyr_sum += V3D(imu->angular_velocity.x, imu->angular_velocity.y, imu->angular_velocity.z).norm();
+    }
+    bool still = false;
+    if (n >= 2)
+    {
+        // relative to the mean norm, so the test holds for accelerometers reporting in g or in m/s^2
+        double acc_mean = acc_sum / n;
+        double acc_std = sqrt(max(acc_sq_sum / n - acc_mean * acc_mean, 0.0));
+        still = acc_mean > 0.0 && acc_std < stationary_acc_ratio * acc_mean && gyr_sum / n < stationary_gyr && vel.norm() < stationary_vel;
+    }
+    stationary_count = still ? stationary_count + 1 : 0;
+    if (!still)
+    {
+        /*** the neighbors were found at the place the platform just left ***/
+        still_nbr_slot.clear();
+        still_nbr_points.clear();
+        still_nbr_kth_dis.clear();
+    }
+    return stationary_count >= stationary_frames;
+}
+
+uint64_t still_voxel_key(const PointType &p)
+{
+    const int64_t offset = 1 << 20;
+    uint64_t kx = uint64_t(int64_t(floor(p.x / filter_size_surf_min)) + offset) & 0x1fffff;
+    uint64_t ky = uint64_t(int64_t(floor(p.y / filter_size_surf_min)) + offset) & 0x1fffff;
+    uint64_t kz = uint64_t(int64_t(floor(p.z / filter_size_surf_min)) + offset) & 0x1fffff;
+    return kx << 42 | ky << 21 | kz;
+}
+
+/*** keep the full neighbor sets of this frame's matched points for the stationary frames that may follow; the
+     frame must be still, so the sets are always found during the current stop ***/
+void still_nbr_store()
+{
+    still_nbr_slot.clear();
+    still_nbr_points.clear();
+    still_nbr_kth_dis.clear();
+    for (int i = 0; i < feats_match_size; i++)
+    {
+        if (nearest_num[i] < NUM_MATCH_POINTS || (plane_cache_en && cached_plane[i] != nullptr)) continue;
+        if (!still_nbr_slot.emplace(still_voxel_key(feats_down_world->points[i]), int(still_nbr_kth_dis.size())).second) continue;
+        still_nbr_points.insert(still_nbr_points.end(), &nearest_flat[i * NUM_MATCH_POINTS], &nearest_flat[(i + 1) * NUM_MATCH_POINTS]);
+        still_nbr_kth_dis.push_back(nearest_kth_dis[i]);
+    }
+}
+
+/*** neighbors of the stored voxel each point falls in, in place of the kNN search; points in other voxels get none ***/
+void still_nbr_lookup()
+{
+    #ifdef MP_EN
+        #pragma omp parallel for
+    #endif
+    for (int i = 0; i < feats_match_size; i++)
+    {
+        auto it = still_nbr_slot.find(still_voxel_key(feats_down_world->points[i]));
+        if (it == still_nbr_slot.end())
+        {
+            nearest_num[i] = 0;
+            nearest_kth_dis[i] = INFINITY;
+            continue;
+        }
+        std::copy(&still_nbr_points[it->second * NUM_MATCH_POINTS], &still_nbr_points[(it->second + 1) * NUM_MATCH_POINTS], &nearest_flat[i * NUM_MATCH_POINTS]);
+        nearest_num[i] = NUM_MATCH_POINTS;
+        nearest_kth_dis[i] = still_nbr_kth_dis[it->second];
+    }
+}
+
+/*** place the body at pos with its heading turned by R, roll and pitch stay with the gravity estimate ***/
+void kf_set_start_pose(const V3D &pos, const M3D &R)
+{
+    state_point = kf_get_x();
+    state_point.pos = pos;
+    state_point.rot = SO3(R * state_point.rot.toRotationMatrix());
+    state_point.grav = S2(R * state_point.grav.get_vect());
+    state_point.vel.setZero();
+    kf_change_x(state_point);
+}
+
+/*** search the prior map around the current pose for the first scan, and move the filter there on success ***/
+bool relocalize(RelocResult &res)
+{
+    PointVector map_points;
+    prior_map.page(nullptr, LocalMap_Points, map_points);
+    relocalizer.set_map(map_points);
+
+    /*** the scan in the IMU frame, leveled by the filter's roll and pitch ***/
+    state_ikfom s = kf_get_x();
+    PointVector scan(feats_down_size);
+    for (int i = 0; i < feats_down_size; i++)
+    {
+        const PointType &p = feats_down_body->points[i];
+        V3D p_lvl(s.rot * (s.offset_R_L_I * V3D(p.x, p.y, p.z) + s.offset_T_L_I));
+        scan[i] = p;
+        scan[i].x = p_lvl(0);
+        scan[i].y = p_lvl(1);
+        scan[i].z = p_lvl(2);
+    }
+    res = relocalizer.locate(scan, s.pos, ikdtree);
+    if (res.inlier_ratio < reloc_min_inlier) return false;
+    kf_set_start_pose(res.t, res.R);
+    pos_lid = state_point.pos + state_point.rot * state_point.offset_T_L_I;
+    return true;
+}
+
 void reset_pos()
 {
     state_point.pos(0) = 0.0;
@@ -357,7 +748,7 @@ void reset_pos()
     geoQuat.z = 0.0;
     geoQuat.w = 1.0;
 
-    kf.change_x(state_point);
+    kf_change_x(state_point);
 }
 
 
@@ -365,6 +756,30 @@ void reset_pos()
 double timediff_lidar_wrt_imu = 0.0;
 bool   timediff_set_flg = false;
 
+/*
+* @brief : Keep imu_buffer within max_imu_queue samples. Samples older than the oldest queued scan are dropped
+*          first; the samples a queued scan still needs only go together with that scan. The scan already taken
+*          by sync_packages (lidar_pushed) is never dropped, so the bound may be exceeded until it is processed.
+*/
+void bound_imu_queue()
+{
+    if (max_imu_queue <= 0) return;
+    while (int(imu_buffer.size()) > max_imu_queue)
+    {
+        if (lidar_buffer.empty() || get_time_sec(imu_buffer.front()->header.stamp) < time_buffer.front())
+        {
+            imu_buffer.pop_front();
+        }
+        else if (!lidar_pushed)
+        {
+            lidar_buffer.pop_front();
+            time_buffer.pop_front();
+            lidar_drop_num ++;
+        }
+        else break;
+    }
+}
+
 void imu_cbk(const sensor_msgs::msg::Imu::UniquePtr msg_in)
 {
     publish_count ++;
@@ -393,13 +808,124 @@ void imu_cbk(const sensor_msgs::msg::Imu::UniquePtr msg_in)
     last_timestamp_imu = timestamp;
 
     imu_buffer.push_back(msg);
+    bound_imu_queue();
     mtx_buffer.unlock();
     sig_buffer.notify_all();
 }
 
+/*
+* @brief : Keep lidar_buffer within max_lidar_queue scans. A scan already taken by sync_packages
+*          (lidar_pushed) stays at the front and does not count against the bound.
+*/
+void bound_lidar_queue()
+{
+    if (max_lidar_queue <= 0) return;
+    int first = lidar_pushed ? 1 : 0;
+    const int queue_len = max_lidar_queue * sub_sweep_num;
+    while (int(lidar_buffer.size()) - first > queue_len)
+    {
+        if (lidar_queue_policy == MERGE_SCANS && int(lidar_buffer.size()) - first > 1)
+        {
+            /*** append the second oldest scan to the oldest one, re-timed to its start ***/
+            PointCloudXYZI::Ptr &scan = lidar_buffer[first];
+            const PointCloudXYZI::Ptr &next = lidar_buffer[first + 1];
+            float offset_ms = (time_buffer[first + 1] - time_buffer[first]) * 1000.0;
+            scan->reserve(scan->size() + next->size());
+            for (PointType p : next->points)
+            {
+                p.curvature += offset_ms;
+                scan->push_back(p);
+            }
+            lidar_buffer.erase(lidar_buffer.begin() + first + 1);
+            time_buffer.erase(time_buffer.begin() + first + 1);
+        }
+        else
+        {
+            int drop_num = lidar_queue_policy == DROP_TO_LATEST ? int(lidar_buffer.size()) - first - 1 : 1;
+            lidar_buffer.erase(lidar_buffer.begin() + first, lidar_buffer.begin() + first + drop_num);
+            time_buffer.erase(time_buffer.begin() + first, time_buffer.begin() + first + drop_num);
+            lidar_drop_num += drop_num;
+        }
+    }
+}
+
 double lidar_mean_scantime = 0.0;
 int    scan_num = 0;
 
+/*
+* @brief : Queue a preprocessed scan, whole or as sub_sweep_num frames of equal duration. Each sub-sweep is
+*          stamped with its start time and its point times re-based to it, so sync_packages, the deskew and the
+*          update treat it as a short scan and the odometry comes out sub_sweep_num times per scan. The split
+*          happens once the whole scan has arrived, so this gives more poses per scan, not an earlier first pose.
+* @param scan     : preprocessed scan, curvature holds the point time offset in ms
+* @param beg_time : time of the first point of the scan
+*/
+void push_lidar_scan(const PointCloudXYZI::Ptr &scan, double beg_time)
+{
+    if (sub_sweep_num <= 1 || scan->size() < 2 * size_t(sub_sweep_num))
+    {
+        lidar_buffer.push_back(scan);
+        time_buffer.push_back(beg_time);
+        return;
+    }
+
+    sort(scan->points.begin(), scan->points.end(), time_list);
+    const float sweep_ms = scan->points.back().curvature / sub_sweep_num;
+    if (sweep_ms <= 0.0f)
+    {
+        lidar_buffer.push_back(scan);
+        time_buffer.push_back(beg_time);
+        return;
+    }
+    auto it = scan->points.begin();
+    for (int k = 0; k < sub_sweep_num; k++)
+    {
+        const float sweep_beg = k * sweep_ms;
+        auto end = k == sub_sweep_num - 1 ? scan->points.end() :
+                   lower_bound(it, scan->points.end(), sweep_beg + sweep_ms, [](const PointType &p, float t) { return p.curvature < t; });
+        if (end == it) continue;
+        PointCloudXYZI::Ptr sweep(new PointCloudXYZI());
+        sweep->points.assign(it, end);
+        sweep->width = sweep->points.size();
+        sweep->height = 1;
+        for (PointType &p : sweep->points) p.curvature -= sweep_beg;
+        lidar_buffer.push_back(sweep);
+        time_buffer.push_back(beg_time + sweep_beg / double(1000));
+        it = end;
+    }
+}
+
+/*
+* @brief : Preprocess the raw scans queued for every LiDAR, the LiDARs in parallel, and queue the merged scans
+*          that are complete.
+*/
+void merge_lidar_scans()
+{
+    const int source_num = lidar_merger.source_num();
+    vector<vector<pair<PointCloudXYZI::Ptr, double>>> scans(source_num);
+    #ifdef MP_EN
+        #pragma omp parallel for num_threads(min(source_num, MP_PROC_NUM))
+    #endif
+    for (int k = 0; k < source_num; k++)
+    {
+        for (auto &raw : lidar_raw[k])
+        {
+            PointCloudXYZI::Ptr ptr(new PointCloudXYZI());
+            lidar_pre[k]->process(raw.first, ptr);
+            scans[k].emplace_back(ptr, raw.second);
+        }
+        lidar_raw[k].clear();
+    }
+    for (int k = 0; k < source_num; k++)
+    {
+        for (auto &scan : scans[k]) lidar_merger.push(k, scan.first, scan.second);
+    }
+
+    PointCloudXYZI::Ptr merged;
+    double beg_time;
+    while (lidar_merger.pop(merged, beg_time)) push_lidar_scan(merged, beg_time);
+}
+
 
 void keyFrame_cbk(const nav_msgs::msg::Path::UniquePtr msg_keyframes){
     pathKeyFrames = *msg_keyframes;
@@ -468,54 +994,215 @@ bool sync_packages(MeasureGroup &meas)
     return true;
 }
 
+/*** map insertion thread: the only writer of ikdtree while enabled, fed in frame order ***/
+struct MapInsertBatch
+{
+    PointVector to_add;           // inserted with the tree's downsampling
+    PointVector no_downsample;
+    double      stamp;
+};
+bool   map_thread_en = false;
+deque<MapInsertBatch> map_insert_queue;
+bool   map_insert_busy = false, map_thread_exit = false;
+mutex  mtx_map_insert;
+condition_variable sig_map_insert, sig_map_idle;
+thread map_thread;
+
+void map_insert_apply(PointVector &to_add, PointVector &no_downsample, double stamp)
+{
+    double st_time = omp_get_wtime();
+    if (localization_en)
+    {
+        /*** dynamic layer: never downsampled against the prior map, and removed again after dynamic_layer_time ***/
+        to_add.insert(to_add.end(), no_downsample.begin(), no_downsample.end());
+        ikdtree.Add_Points(to_add, false);
+        if (fov_cull_en) fov_culler.add_points(to_add);
+        dynamic_layer.emplace_back(stamp, PointVector());
+        dynamic_layer.back().second.swap(to_add);
+        while (!dynamic_layer.empty() && stamp - dynamic_layer.front().first > dynamic_layer_time)
+        {
+            /*** the points of a parked block are out of the tree, drop its copy too or they come back when it is restored ***/
+            ikdtree.Delete_Points(dynamic_layer.front().second);
+            if (fov_cull_en) fov_culler.remove_points(dynamic_layer.front().second);
+            dynamic_layer.pop_front();
+        }
+        kdtree_incremental_time = omp_get_wtime() - st_time;
+        return;
+    }
+    ikdtree.Add_Points(to_add, true);
+    ikdtree.Add_Points(no_downsample, false); 
+    if (plane_cache_en)
+    {
+        plane_cache.add_points(to_add);
+        plane_cache.add_points(no_downsample);
+    }
+    if (fov_cull_en)
+    {
+        fov_culler.add_points(to_add);
+        fov_culler.add_points(no_downsample);
+    }
+    kdtree_incremental_time = omp_get_wtime() - st_time;
+}
+
+void map_thread_loop()
+{
+    while (true)
+    {
+        MapInsertBatch batch;
+        {
+            unique_lock<mutex> lock(mtx_map_insert);
+            sig_map_insert.wait(lock, []{ return map_thread_exit || !map_insert_queue.empty(); });
+            if (map_insert_queue.empty()) return;
+            batch = std::move(map_insert_queue.front());
+            map_insert_queue.pop_front();
+            map_insert_busy = true;
+        }
+        map_insert_apply(batch.to_add, batch.no_downsample, batch.stamp);
+        {
+            lock_guard<mutex> lock(mtx_map_insert);
+            map_insert_busy = false;
+        }
+        sig_map_idle.notify_all();
+    }
+}
+
+/*** block until every queued batch is in the map, so ikdtree can be read or changed from this thread ***/
+void map_insert_wait()
+{
+    if (!map_thread_en) return;
+    unique_lock<mutex> lock(mtx_map_insert);
+    sig_map_idle.wait(lock, []{ return map_insert_queue.empty() && !map_insert_busy; });
+}
+
+/*** copy the whole map (the tree and the points parked by the FOV culling) and the current state for snapshot_writer ***/
+bool map_snapshot_save()
+{
+    if (ikdtree.Root_Node == nullptr) return false;
+    map_insert_wait();
+    PointVector points;
+    ikdtree.flatten(ikdtree.Root_Node, points, NOT_RECORD);
+    if (fov_cull_en) fov_culler.append_parked(points);
+    last_snapshot_time = lidar_end_time;
+    snapshot_writer.request(snapshot_path, points, state_point, lidar_end_time);
+    return true;
+}
+
 int process_increments = 0;
+vector<PointVector> add_bufs, no_downsample_bufs;   // per-thread output of map_incremental
 void map_incremental()
 {
-    PointVector PointToAdd;
-    PointVector PointNoNeedDownsample;
-    PointToAdd.reserve(feats_down_size);
-    PointNoNeedDownsample.reserve(feats_down_size);
+    if (localization_en && !dynamic_layer_en)
+    {
+        add_point_size = 0;
+        return;
+    }
+    #ifdef MP_EN
+        omp_set_num_threads(MP_PROC_NUM);
+    #endif
+    int thread_num = omp_get_max_threads();
+    if (int(add_bufs.size()) < thread_num)
+    {
+        add_bufs.resize(thread_num);
+        no_downsample_bufs.resize(thread_num);
+    }
+    for (int t = 0; t < thread_num; t++)
+    {
+        add_bufs[t].clear();
+        no_downsample_bufs[t].clear();
+    }
+
+    /* the points left out of the matching have no neighbors yet: one search for them at the updated pose */
+    if (feats_match_size < feats_down_size && flg_EKF_inited)
+    {
+        const int tail = feats_down_size - feats_match_size;
+        #ifdef MP_EN
+            #pragma omp parallel for
+        #endif
+        for (int i = feats_match_size; i < feats_down_size; i++)
+        {
+            pointBodyToWorld(&(feats_down_body->points[i]), &(feats_down_world->points[i]));
+        }
+        knn_batch.search(ikdtree, &feats_down_world->points[feats_match_size], tail, NUM_MATCH_POINTS, filter_size_map_min,
+                         &nearest_flat[(long)feats_match_size * NUM_MATCH_POINTS], &nearest_num[feats_match_size], &nearest_kth_dis[feats_match_size]);
+    }
+
+    const float map_res = filter_size_map_min, half_res = 0.5f * filter_size_map_min;
+    /* static schedule: thread t takes the t-th contiguous chunk, so concatenating the buffers keeps the scan order */
+    #ifdef MP_EN
+        #pragma omp parallel for schedule(static)
+    #endif
     for (int i = 0; i < feats_down_size; i++)
     {
+        PointVector &to_add = add_bufs[omp_get_thread_num()];
+        PointVector &no_downsample = no_downsample_bufs[omp_get_thread_num()];
         /* transform to world frame */
         pointBodyToWorld(&(feats_down_body->points[i]), &(feats_down_world->points[i]));
+        const PointType &point_world = feats_down_world->points[i];
         /* decide if need add to map */
-        if (!Nearest_Points[i].empty() && flg_EKF_inited)
+        if (nearest_num[i] > 0 && flg_EKF_inited)
         {
-            const PointVector &points_near = Nearest_Points[i];
-            bool need_add = true;
-            BoxPointType Box_of_Point;
-            PointType downsample_result, mid_point; 
-            mid_point.x = floor(feats_down_world->points[i].x/filter_size_map_min)*filter_size_map_min + 0.5 * filter_size_map_min;
-            mid_point.y = floor(feats_down_world->points[i].y/filter_size_map_min)*filter_size_map_min + 0.5 * filter_size_map_min;
-            mid_point.z = floor(feats_down_world->points[i].z/filter_size_map_min)*filter_size_map_min + 0.5 * filter_size_map_min;
-            float dist  = calc_dist(feats_down_world->points[i],mid_point);
-            if (fabs(points_near[0].x - mid_point.x) > 0.5 * filter_size_map_min && fabs(points_near[0].y - mid_point.y) > 0.5 * filter_size_map_min && fabs(points_near[0].z - mid_point.z) > 0.5 * filter_size_map_min){
-                PointNoNeedDownsample.push_back(feats_down_world->points[i]);
+            const PointType *points_near = &nearest_flat[i * NUM_MATCH_POINTS];
+            Array3f p(point_world.x, point_world.y, point_world.z);
+            Array3f mid_point = (p / map_res).floor() * map_res + half_res;
+            if (((Array3f(points_near[0].x, points_near[0].y, points_near[0].z) - mid_point).abs() > half_res).all())
+            {
+                no_downsample.push_back(point_world);
                 continue;
             }
-            for (int readd_i = 0; readd_i < NUM_MATCH_POINTS; readd_i ++)
+            float dist = (p - mid_point).matrix().squaredNorm();
+            bool need_add = true;
+            if (nearest_num[i] == NUM_MATCH_POINTS)
             {
-                if (points_near.size() < NUM_MATCH_POINTS) break;
-                if (calc_dist(points_near[readd_i], mid_point) < dist)
+                for (int readd_i = 0; readd_i < NUM_MATCH_POINTS; readd_i ++)
                 {
-                    need_add = false;
-                    break;
+                    Array3f near(points_near[readd_i].x, points_near[readd_i].y, points_near[readd_i].z);
+                    if ((near - mid_point).matrix().squaredNorm() < dist)
+                    {
+                        need_add = false;
+                        break;
+                    }
                 }
             }
-            if (need_add) PointToAdd.push_back(feats_down_world->points[i]);
+            if (need_add) to_add.push_back(point_world);
         }
         else
         {
-            PointToAdd.push_back(feats_down_world->points[i]);
+            to_add.push_back(point_world);
         }
     }
 
-    double st_time = omp_get_wtime();
-    add_point_size = ikdtree.Add_Points(PointToAdd, true);
-    ikdtree.Add_Points(PointNoNeedDownsample, false); 
+    /* merge the per-thread buffers in thread order */
+    size_t add_num = 0, no_downsample_num = 0;
+    for (int t = 0; t < thread_num; t++)
+    {
+        add_num += add_bufs[t].size();
+        no_downsample_num += no_downsample_bufs[t].size();
+    }
+    PointVector PointToAdd;
+    PointVector PointNoNeedDownsample;
+    PointToAdd.reserve(add_num);
+    PointNoNeedDownsample.reserve(no_downsample_num);
+    for (int t = 0; t < thread_num; t++)
+    {
+        PointToAdd.insert(PointToAdd.end(), add_bufs[t].begin(), add_bufs[t].end());
+        PointNoNeedDownsample.insert(PointNoNeedDownsample.end(), no_downsample_bufs[t].begin(), no_downsample_bufs[t].end());
+    }
+
     add_point_size = PointToAdd.size() + PointNoNeedDownsample.size();
-    kdtree_incremental_time = omp_get_wtime() - st_time;
+    if (map_thread_en)
+    {
+        MapInsertBatch batch;
+        batch.to_add.swap(PointToAdd);
+        batch.no_downsample.swap(PointNoNeedDownsample);
+        batch.stamp = lidar_end_time;
+        {
+            lock_guard<mutex> lock(mtx_map_insert);
+            map_insert_queue.push_back(std::move(batch));
+        }
+        sig_map_insert.notify_one();
+        return;
+    }
+    map_insert_apply(PointToAdd, PointNoNeedDownsample, lidar_end_time);
 }
 
 PointCloudXYZI::Ptr pcl_wait_pub(new PointCloudXYZI());
@@ -667,7 +1354,7 @@ void publish_odometry(const rclcpp::Publisher<nav_msgs::msg::Odometry>::SharedPt
     //odomAftMapped.twist.covariance[0] = data_seq;
     set_posestamp(odomAftMapped.pose);
     pubOdomAftMapped->publish(odomAftMapped);
-    auto P = kf.get_P();
+    Eigen::Matrix<double, 6, 6> P = kf_pose_cov();
     for (int i = 0; i < 6; i ++)
     {
         int k = i < 3 ? i + 3 : i - 3;
@@ -710,75 +1397,123 @@ void publish_path(rclcpp::Publisher<nav_msgs::msg::Path>::SharedPtr pubPath)
     }
 }
 
-void h_share_model(state_ikfom &s, esekfom::dyn_share_datastruct<double> &ekfom_data)
+template<typename S>
+void h_share_model(S &s, esekfom::dyn_share_datastruct<double> &ekfom_data)
 {
     double match_start = omp_get_wtime();
-    laserCloudOri->clear(); 
-    corr_normvect->clear(); 
     total_residual = 0.0; 
 
-    /** closest surface search and residual computation **/
+    /*** the first convergence on the coarse level moves the update to the full scan, with a fresh search, so the
+         last iteration, whose Jacobian sets the covariance, is always at full resolution ***/
+    if (pyramid_coarse && ekfom_data.converge && h_model_calls > 0) pyramid_coarse = false;
+    h_model_calls ++;
+    const bool search_skip_en = plane_cache_en || pyramid_coarse;
+
     #ifdef MP_EN
         omp_set_num_threads(MP_PROC_NUM);
+    #endif
+
+    /* transform to world frame */
+    #ifdef MP_EN
         #pragma omp parallel for
     #endif
-    for (int i = 0; i < feats_down_size; i++)
+    for (int i = 0; i < feats_match_size; i++)
     {
-        PointType &point_body  = feats_down_body->points[i]; 
+        const PointType &point_body  = feats_down_body->points[i]; 
         PointType &point_world = feats_down_world->points[i]; 
-
-        /* transform to world frame */
         V3D p_body(point_body.x, point_body.y, point_body.z);
-        V3D p_global(s.rot * (s.offset_R_L_I*p_body + s.offset_T_L_I) + s.pos);
+        V3D p_global(s.rot * (offset_R_L_I(s)*p_body + offset_T_L_I(s)) + s.pos);
         point_world.x = p_global(0);
         point_world.y = p_global(1);
         point_world.z = p_global(2);
         point_world.intensity = point_body.intensity;
+        if (plane_cache_en) cached_plane[i] = plane_cache.find(point_world);
+        if (search_skip_en) search_skip[i] = (plane_cache_en && cached_plane[i] != nullptr) || (pyramid_coarse && coarse_skip[i]);
+    }
 
-        vector<float> pointSearchSqDis(NUM_MATCH_POINTS);
+    /** Find the closest surfaces in the map, one batch for the whole scan, skipping points with a cached plane;
+        a stationary frame reuses the neighbors stored during the current stop and searches only when there are none **/
+    if (ekfom_data.converge && stationary && !still_nbr_slot.empty())
+    {
+        still_nbr_lookup();
+    }
+    else if (ekfom_data.converge)
+    {
+        double search_start = omp_get_wtime();
+        knn_batch.search(ikdtree, feats_down_world->points.data(), feats_match_size, NUM_MATCH_POINTS, filter_size_map_min,
+                         nearest_flat.data(), nearest_num.data(), nearest_kth_dis.data(), search_skip_en ? search_skip.data() : nullptr);
+        kdtree_search_time += omp_get_wtime() - search_start;
+    }
 
-        auto &points_near = Nearest_Points[i];
+    /** residual computation **/
+    #ifdef MP_EN
+        #pragma omp parallel for
+    #endif
+    for (int i = 0; i < feats_match_size; i++)
+    {
+        const PointType &point_world = feats_down_world->points[i]; 
+        V3D p_body(feats_down_body->points[i].x, feats_down_body->points[i].y, feats_down_body->points[i].z);
+        const PointType *points_near = &nearest_flat[i * NUM_MATCH_POINTS];
+        VF(4) pabcd;
+        bool plane_found;
 
-        if (ekfom_data.converge)
+        if (pyramid_coarse && coarse_skip[i])
         {
-            /** Find the closest surfaces in the map **/
-            ikdtree.Nearest_Search(point_world, NUM_MATCH_POINTS, points_near, pointSearchSqDis);
-            point_selected_surf[i] = points_near.size() < NUM_MATCH_POINTS ? false : pointSearchSqDis[NUM_MATCH_POINTS - 1] > 5 ? false : true;
+            plane_matches.selected[i] = false;
+            continue;
         }
+        if (plane_cache_en && cached_plane[i] != nullptr)
+        {
+            /** the voxel's plane replaces the neighbor search and fit **/
+            const VoxelPlane &plane = *cached_plane[i];
+            pabcd << plane.normal(0), plane.normal(1), plane.normal(2), plane.d;
+            plane_found = true;
+        }
+        else
+        {
+            if (ekfom_data.converge)
+            {
+                plane_matches.selected[i] = nearest_num[i] < NUM_MATCH_POINTS ? false : nearest_kth_dis[i] > 5 ? false : true;
+            }
 
-        if (!point_selected_surf[i]) continue;
+            // neighbors are missing when the point had a cached plane at the last search
+            if (!plane_matches.selected[i] || nearest_num[i] < NUM_MATCH_POINTS) continue;
+            plane_found = esti_plane(pabcd, points_near, 0.1f);
+        }
 
-        VF(4) pabcd;
-        point_selected_surf[i] = false;
-        if (esti_plane(pabcd, points_near, 0.1f))
+        plane_matches.selected[i] = false;
+        if (plane_found)
         {
             float pd2 = pabcd(0) * point_world.x + pabcd(1) * point_world.y + pabcd(2) * point_world.z + pabcd(3);
             float s = 1 - 0.9 * fabs(pd2) / sqrt(p_body.norm());
 
             if (s > 0.9)
             {
-                point_selected_surf[i] = true;
-                normvec->points[i].x = pabcd(0);
-                normvec->points[i].y = pabcd(1);
-                normvec->points[i].z = pabcd(2);
-                normvec->points[i].intensity = pd2;
-                res_last[i] = abs(pd2);
+                plane_matches.selected[i] = true;
+                plane_matches.nx[i] = pabcd(0);
+                plane_matches.ny[i] = pabcd(1);
+                plane_matches.nz[i] = pabcd(2);
+                plane_matches.pd2[i] = pd2;
+                plane_matches.res[i] = abs(pd2);
             }
         }
     }
     
     effct_feat_num = 0;
+    effct_idx.resize(feats_match_size);
+    laserCloudOri->resize(feats_match_size);
 
-    for (int i = 0; i < feats_down_size; i++)
+    for (int i = 0; i < feats_match_size; i++)
     {
-        if (point_selected_surf[i])
+        if (plane_matches.selected[i])
         {
             laserCloudOri->points[effct_feat_num] = feats_down_body->points[i];
-            corr_normvect->points[effct_feat_num] = normvec->points[i];
-            total_residual += res_last[i];
+            effct_idx[effct_feat_num] = i;
+            total_residual += plane_matches.res[i];
             effct_feat_num ++;
         }
     }
+    laserCloudOri->resize(effct_feat_num);
 
     if (effct_feat_num < 1)
     {
@@ -792,7 +1527,7 @@ void h_share_model(state_ikfom &s, esekfom::dyn_share_datastruct<double> &ekfom_
     double solve_start_  = omp_get_wtime();
     
     /*** Computation of Measuremnt Jacobian matrix H and measurents vector ***/
-    ekfom_data.h_x = MatrixXd::Zero(effct_feat_num, 12); //23
+    ekfom_data.h_x = MatrixXd::Zero(effct_feat_num, lidar_meas_dof<S>::value); //23
     ekfom_data.h.resize(effct_feat_num);
 
     for (int i = 0; i < effct_feat_num; i++)
@@ -801,33 +1536,143 @@ void h_share_model(state_ikfom &s, esekfom::dyn_share_datastruct<double> &ekfom_
         V3D point_this_be(laser_p.x, laser_p.y, laser_p.z);
         M3D point_be_crossmat;
         point_be_crossmat << SKEW_SYM_MATRX(point_this_be);
-        V3D point_this = s.offset_R_L_I * point_this_be + s.offset_T_L_I;
+        V3D point_this = offset_R_L_I(s) * point_this_be + offset_T_L_I(s);
         M3D point_crossmat;
         point_crossmat<<SKEW_SYM_MATRX(point_this);
 
         /*** get the normal vector of closest surface/corner ***/
-        const PointType &norm_p = corr_normvect->points[i];
-        V3D norm_vec(norm_p.x, norm_p.y, norm_p.z);
+        const int k = effct_idx[i];
+        V3D norm_vec(plane_matches.nx[k], plane_matches.ny[k], plane_matches.nz[k]);
 
         /*** calculate the Measuremnt Jacobian matrix H ***/
         V3D C(s.rot.conjugate() *norm_vec);
         V3D A(point_crossmat * C);
-        if (extrinsic_est_en)
+        if (lidar_meas_dof<S>::value == 12)
         {
-            V3D B(point_be_crossmat * s.offset_R_L_I.conjugate() * C); //s.rot.conjugate()*norm_vec);
-            ekfom_data.h_x.block<1, 12>(i,0) << norm_p.x, norm_p.y, norm_p.z, VEC_FROM_ARRAY(A), VEC_FROM_ARRAY(B), VEC_FROM_ARRAY(C);
+            V3D B(point_be_crossmat * offset_R_L_I(s).conjugate() * C); //s.rot.conjugate()*norm_vec);
+            ekfom_data.h_x.block<1, 12>(i,0) << VEC_FROM_ARRAY(norm_vec), VEC_FROM_ARRAY(A), VEC_FROM_ARRAY(B), VEC_FROM_ARRAY(C);
         }
         else
         {
-            ekfom_data.h_x.block<1, 12>(i,0) << norm_p.x, norm_p.y, norm_p.z, VEC_FROM_ARRAY(A), 0.0, 0.0, 0.0, 0.0, 0.0, 0.0;
+            ekfom_data.h_x.block<1, 6>(i,0) << VEC_FROM_ARRAY(norm_vec), VEC_FROM_ARRAY(A);
         }
 
         /*** Measuremnt: distance to the closest surface/corner ***/
-        ekfom_data.h(i) = -norm_p.intensity;
+        ekfom_data.h(i) = -plane_matches.pd2[k];
     }
     solve_time += omp_get_wtime() - solve_start_;
 }
 
+/*** filter statistics of the active filter ***/
+void kf_set_max_iter(int max_iter)
+{
+    kf_max_iter = max_iter;
+    if (extrinsic_est_en) kf.change_max_iter(max_iter);
+    else kf_fixed.change_max_iter(max_iter);
+}
+
+void kf_iter_stats(int &iter_num, double &dx_first_norm, double &dx_rate)
+{
+    if (extrinsic_est_en)
+    {
+        iter_num = kf.get_iter_num(); dx_first_norm = kf.get_dx_first_norm(); dx_rate = kf.get_dx_rate();
+    }
+    else
+    {
+        iter_num = kf_fixed.get_iter_num(); dx_first_norm = kf_fixed.get_dx_first_norm(); dx_rate = kf_fixed.get_dx_rate();
+    }
+}
+
+/*
+* @brief : Choose the iteration count and the number of points for this frame's update from the time
+*          left before the next scan is due and the convergence of the previous update.
+* @param frame_start : omp wall time the frame started processing
+* @param conv_limit  : per-dimension convergence limit of the filter
+* @return point budget, at most feats_match_size
+*/
+int plan_update_budget(double frame_start, double conv_limit)
+{
+    int iter_num;
+    double dx_first_norm, dx_rate;
+    kf_iter_stats(iter_num, dx_first_norm, dx_rate);
+
+    /*** iterations the last contraction rate needs to bring the first step below the limit, plus the confirming one ***/
+    int max_iter = NUM_MAX_ITERATIONS;
+    if (dx_rate > 0.0 && dx_rate < 1.0 && dx_first_norm > conv_limit)
+    {
+        max_iter = 2 + int(min(double(NUM_MAX_ITERATIONS), ceil(log(conv_limit / dx_first_norm) / log(dx_rate))));
+    }
+    else if (iter_num > 0 && dx_first_norm <= conv_limit)
+    {
+        max_iter = 2;
+    }
+    max_iter = max(1, min(max_iter, NUM_MAX_ITERATIONS));
+
+    /*** share the time left between this scan and the ones already queued ***/
+    double time_left = deadline_ratio * scan_period / (1 + lidar_buffer.size()) - (omp_get_wtime() - frame_start);
+    int point_budget = feats_match_size;
+    if (update_cost_per_pt > 0.0)
+    {
+        int point_floor = min(feats_match_size, deadline_min_points);
+        // each update evaluates the measurement max_iter + 1 times at most
+        while (max_iter > 1 && time_left < update_cost_per_pt * point_floor * (max_iter + 1)) max_iter --;
+        double affordable = time_left / (update_cost_per_pt * (max_iter + 1));
+        if (affordable < feats_match_size) point_budget = max(point_floor, int(affordable));
+    }
+
+    kf_set_max_iter(max_iter);
+    return point_budget;
+}
+
+/*** move feats_down_body->points[idx[j]] to position j, idx strictly increasing; the other points follow in some order ***/
+void move_to_front(const vector<int> &idx)
+{
+    // idx[j] >= j and no earlier swap touched position idx[j], so each swap brings in an original point
+    for (int j = 0; j < int(idx.size()); j++)
+    {
+        if (idx[j] != j) std::swap(feats_down_body->points[j], feats_down_body->points[idx[j]]);
+    }
+}
+
+/*** match only point_budget points of the matching set, evenly spread over it; the others still go to the map ***/
+void subsample_feats_down(int point_budget)
+{
+    if (point_budget >= feats_match_size) return;
+    static vector<int> budget_idx;
+    budget_idx.resize(point_budget);
+    for (int j = 0; j < point_budget; j++) budget_idx[j] = (long)j * feats_match_size / point_budget;
+    move_to_front(budget_idx);
+    feats_match_size = point_budget;
+}
+
+/*** match only the point_select_num points of feats_down_body that constrain the predicted pose best; all go to the map ***/
+void select_feats_down()
+{
+    if (point_select_num >= feats_match_size) return;
+    point_selector.select(feats_down_body->points.data(), feats_match_size, state_point.rot.toRotationMatrix(), state_point.pos,
+                          state_point.offset_R_L_I.toRotationMatrix(), state_point.offset_T_L_I, point_select_num, point_select_keep);
+    move_to_front(point_select_keep);
+    feats_match_size = point_select_keep.size();
+}
+
+/*** the coarse level of the scan: the first point of feats_down_body in each pyramid_leaf voxel ***/
+void build_coarse_level()
+{
+    static unordered_set<uint64_t> occupied;
+    occupied.clear();
+    coarse_skip.assign(feats_match_size, 1);
+    const int64_t offset = 1 << 20;
+    for (int i = 0; i < feats_match_size; i++)
+    {
+        const PointType &p = feats_down_body->points[i];
+        uint64_t kx = uint64_t(int64_t(floor(p.x / pyramid_leaf)) + offset) & 0x1fffff;
+        uint64_t ky = uint64_t(int64_t(floor(p.y / pyramid_leaf)) + offset) & 0x1fffff;
+        uint64_t kz = uint64_t(int64_t(floor(p.z / pyramid_leaf)) + offset) & 0x1fffff;
+        if (occupied.insert(kx << 42 | ky << 21 | kz).second) coarse_skip[i] = 0;
+    }
+    pyramid_coarse = true;
+}
+
 /*
 * @brief : Save the whole trajectory to a txt file (TUM format)
 */
@@ -878,6 +1723,11 @@ public:
         filter_size_map_min = this->declare_parameter<double>("lio.common.filter_size_map", 0.5);
         cube_len = this->declare_parameter<double>("lio.common.cube_side_length", 1000.0);
         debug_print = this->declare_parameter<bool>("lio.common.debug_print", false);
+        max_lidar_queue = this->declare_parameter<int>("lio.common.max_lidar_queue", 0);
+        max_imu_queue = this->declare_parameter<int>("lio.common.max_imu_queue", 0);
+        lidar_queue_policy = this->declare_parameter<int>("lio.common.lidar_queue_policy", int(DROP_OLDEST));
+        sub_sweep_num = max(1, int(this->declare_parameter<int>("lio.common.sub_sweep_num", 1)));
+        livox_custom_msg = this->declare_parameter<bool>("lio.common.livox_custom_msg", false);
         
 
         p_pre->lidar_type = this->declare_parameter<int>("lio.preprocess.lidar_type", 2);
@@ -887,6 +1737,29 @@ public:
         p_pre->SCAN_RATE = this->declare_parameter<int>("lio.preprocess.scan_rate", 10);
         p_pre->point_filter_num = this->declare_parameter<int>("lio.preprocess.point_filter_num", 4);
         p_pre->feature_enabled = this->declare_parameter<bool>("lio.preprocess.feature_extract_enable", false);
+        p_pre->row_stride = max(1, int(this->declare_parameter<int>("lio.preprocess.row_stride", 1)));
+        p_pre->col_stride = max(1, int(this->declare_parameter<int>("lio.preprocess.col_stride", p_pre->point_filter_num)));
+
+        extra_lidar_num = max(0, int(this->declare_parameter<int>("lio.multi_lidar.extra_lidar_num", 0)));
+        vector<vector<double>> extra_extrinT, extra_extrinR;
+        for (int k = 1; k <= extra_lidar_num; k++)
+        {
+            string ns = "lio.multi_lidar.extra_lidar" + to_string(k) + ".";
+            shared_ptr<Preprocess> pre(new Preprocess());
+            extra_lid_topics.push_back(this->declare_parameter<string>(ns + "lid_topic", ""));
+            pre->lidar_type = this->declare_parameter<int>(ns + "lidar_type", p_pre->lidar_type);
+            pre->N_SCANS = this->declare_parameter<int>(ns + "scan_line", p_pre->N_SCANS);
+            pre->time_unit = this->declare_parameter<int>(ns + "timestamp_unit", p_pre->time_unit);
+            pre->blind = this->declare_parameter<double>(ns + "blind", p_pre->blind);
+            pre->SCAN_RATE = p_pre->SCAN_RATE;
+            pre->point_filter_num = p_pre->point_filter_num;
+            pre->row_stride = p_pre->row_stride;
+            pre->col_stride = p_pre->col_stride;
+            pre->feature_enabled = false;
+            lidar_pre.push_back(pre);
+            extra_extrinT.push_back(this->declare_parameter<vector<double>>(ns + "extrinsic_T", vector<double>()));
+            extra_extrinR.push_back(this->declare_parameter<vector<double>>(ns + "extrinsic_R", vector<double>()));
+        }
 
 
         path_en = this->declare_parameter<bool>("lio.publish.path_en", false);
@@ -909,6 +1782,29 @@ public:
         extrinsic_est_en = this->declare_parameter<bool>("lio.mapping.extrinsic_est_en", true);
         extrinT = this->declare_parameter<vector<double>>("lio.mapping.extrinsic_T", vector<double>());
         extrinR = this->declare_parameter<vector<double>>("lio.mapping.extrinsic_R", vector<double>());
+        map_thread_en = this->declare_parameter<bool>("lio.mapping.map_thread_en", false);
+        plane_cache_en = this->declare_parameter<bool>("lio.mapping.plane_cache_en", false);
+        plane_cache_voxel = this->declare_parameter<double>("lio.mapping.plane_cache_voxel", 0.5);
+        plane_cache_sigma = this->declare_parameter<double>("lio.mapping.plane_cache_sigma", 0.03);
+        fov_cull_en = this->declare_parameter<bool>("lio.mapping.fov_cull_en", false);
+        fov_cull_block = this->declare_parameter<double>("lio.mapping.fov_cull_block", 10.0);
+        map_tile_en = this->declare_parameter<bool>("lio.mapping.map_tile_en", false);
+        map_tile_size = this->declare_parameter<double>("lio.mapping.map_tile_size", 20.0);
+        map_tile_dir = this->declare_parameter<string>("lio.mapping.map_tile_dir", "");
+        deadline_en = this->declare_parameter<bool>("lio.mapping.deadline_en", false);
+        deadline_ratio = this->declare_parameter<double>("lio.mapping.deadline_ratio", 0.9);
+        deadline_min_points = this->declare_parameter<int>("lio.mapping.deadline_min_points", 500);
+        pyramid_en = this->declare_parameter<bool>("lio.mapping.pyramid_en", false);
+        pyramid_leaf = this->declare_parameter<double>("lio.mapping.pyramid_leaf", 2.0);
+        point_select_en = this->declare_parameter<bool>("lio.mapping.point_select_en", false);
+        point_select_num = this->declare_parameter<int>("lio.mapping.point_select_num", 1000);
+        point_select_voxel = this->declare_parameter<double>("lio.mapping.point_select_voxel", 1.0);
+        stationary_en = this->declare_parameter<bool>("lio.mapping.stationary_en", false);
+        stationary_acc_ratio = this->declare_parameter<double>("lio.mapping.stationary_acc_ratio", 0.01);
+        stationary_gyr = this->declare_parameter<double>("lio.mapping.stationary_gyr", 0.02);
+        stationary_vel = this->declare_parameter<double>("lio.mapping.stationary_vel", 0.1);
+        stationary_vel_std = this->declare_parameter<double>("lio.mapping.stationary_vel_std", 0.01);
+        stationary_frames = this->declare_parameter<int>("lio.mapping.stationary_frames", 5);
 
 
         FusionBufferSize = this->declare_parameter<const int>("lio.fusionCloud.size", 5);
@@ -920,32 +1816,169 @@ public:
         traj_save_en = this->declare_parameter<bool>("lio.traj_save.traj_save_en", false);
         traj_file_path = this->declare_parameter<string>("lio.traj_save.traj_file_path", "");
 
+        snapshot_load_en = this->declare_parameter<bool>("lio.map_snapshot.load_en", false);
+        snapshot_save_en = this->declare_parameter<bool>("lio.map_snapshot.save_en", false);
+        snapshot_interval = this->declare_parameter<double>("lio.map_snapshot.interval", 0.0);
+        snapshot_path = this->declare_parameter<string>("lio.map_snapshot.path", "");
+
+        localization_en = this->declare_parameter<bool>("lio.localization.localization_en", false);
+        prior_map_path = this->declare_parameter<string>("lio.localization.prior_map_path", "");
+        prior_map_tile = this->declare_parameter<double>("lio.localization.prior_map_tile", 20.0);
+        init_pose = this->declare_parameter<vector<double>>("lio.localization.init_pose", vector<double>(4, 0.0));
+        init_pose.resize(4, 0.0);
+        dynamic_layer_en = this->declare_parameter<bool>("lio.localization.dynamic_layer_en", false);
+        dynamic_layer_time = this->declare_parameter<double>("lio.localization.dynamic_layer_time", 5.0);
+        reloc_en = this->declare_parameter<bool>("lio.localization.reloc_en", false);
+        reloc_radius = this->declare_parameter<double>("lio.localization.reloc_radius", 20.0);
+        reloc_step = this->declare_parameter<double>("lio.localization.reloc_step", 1.0);
+        reloc_yaw_step = this->declare_parameter<double>("lio.localization.reloc_yaw_step", 10.0);
+        reloc_fine_num = this->declare_parameter<int>("lio.localization.reloc_fine_num", 8);
+        reloc_min_inlier = this->declare_parameter<double>("lio.localization.reloc_min_inlier", 0.3);
+        reloc_threads = this->declare_parameter<int>("lio.localization.reloc_threads", 0);
+        if (snapshot_path.empty()) snapshot_path = root_dir + "PCD/map.snapshot";
+
         path.header.stamp = this->get_clock()->now();
         path.header.frame_id =odom_frame_id;
 
         FOV_DEG = (fov_deg + 10.0) > 179.9 ? 179.9 : (fov_deg + 10.0);
         HALF_FOV_COS = cos((FOV_DEG) * 0.5 * PI_M / 180.0);
+        if (fov_cull_en && fov_deg >= 180.0)
+        {
+            RCLCPP_WARN(this->get_logger(), "fov_cull_en needs fov_degree < 180, FOV culling disabled");
+            fov_cull_en = false;
+        }
+        fov_culler.set_param(fov_cull_block, HALF_FOV_COS, DET_RANGE);
+        if (map_tile_dir.empty()) map_tile_dir = root_dir + "PCD/map_tiles/";
+        if (map_tile_en && !map_tiles.set_param(map_tile_dir, map_tile_size))
+        {
+            RCLCPP_WARN(this->get_logger(), "Can not create map tile directory %s, map tiling disabled", map_tile_dir.c_str());
+            map_tile_en = false;
+        }
+        if (dynamic_layer_en && dynamic_layer_time <= 0.0)
+        {
+            RCLCPP_WARN(this->get_logger(), "dynamic_layer_time must be positive, dynamic layer disabled");
+            dynamic_layer_en = false;
+        }
 
         _featsArray.reset(new PointCloudXYZI());
 
-        memset(point_selected_surf, true, sizeof(point_selected_surf));
-        memset(res_last, -1000.0f, sizeof(res_last));
         downSizeFilterSurf.setLeafSize(filter_size_surf_min, filter_size_surf_min, filter_size_surf_min);
         downSizeFilterMap.setLeafSize(filter_size_map_min, filter_size_map_min, filter_size_map_min);
         downSizeFilterSurroundingKeyPoses.setLeafSize(0.2,0.2,0.2);
-        memset(point_selected_surf, true, sizeof(point_selected_surf));
-        memset(res_last, -1000.0f, sizeof(res_last));
 
         Lidar_T_wrt_IMU<<VEC_FROM_ARRAY(extrinT);
         Lidar_R_wrt_IMU<<MAT_FROM_ARRAY(extrinR);
         p_imu->set_extrinsic(Lidar_T_wrt_IMU, Lidar_R_wrt_IMU);
+        if (extra_lidar_num > 0)
+        {
+            /*** the extra LiDARs are given relative to the IMU, their points are merged in the primary LiDAR frame ***/
+            lidar_pre.insert(lidar_pre.begin(), p_pre);
+            lidar_raw.resize(extra_lidar_num + 1);
+            lidar_merger.add_source(M3D::Identity(), V3D::Zero());
+            for (int k = 0; k < extra_lidar_num; k++)
+            {
+                V3D T_k(Lidar_T_wrt_IMU);
+                M3D R_k(Lidar_R_wrt_IMU);
+                if (extra_extrinT[k].size() == 3 && extra_extrinR[k].size() == 9)
+                {
+                    T_k << VEC_FROM_ARRAY(extra_extrinT[k]);
+                    R_k << MAT_FROM_ARRAY(extra_extrinR[k]);
+                }
+                else RCLCPP_WARN(this->get_logger(), "Extrinsic of extra_lidar%d is not set, taking the primary LiDAR's", k + 1);
+                lidar_merger.add_source(Lidar_R_wrt_IMU.transpose() * R_k, Lidar_R_wrt_IMU.transpose() * (T_k - Lidar_T_wrt_IMU));
+            }
+        }
         p_imu->set_gyr_cov(V3D(gyr_cov, gyr_cov, gyr_cov));
         p_imu->set_acc_cov(V3D(acc_cov, acc_cov, acc_cov));
         p_imu->set_gyr_bias_cov(V3D(b_gyr_cov, b_gyr_cov, b_gyr_cov));
         p_imu->set_acc_bias_cov(V3D(b_acc_cov, b_acc_cov, b_acc_cov));
+        plane_cache.set_param(plane_cache_voxel, NUM_MATCH_POINTS, plane_cache_sigma);
+        point_selector.set_param(point_select_voxel);
+        if (map_thread_en) map_thread = thread(map_thread_loop);
 
         fill(epsi, epsi+23, 0.001);
-        kf.init_dyn_share(get_f, df_dx, df_dw, h_share_model, NUM_MAX_ITERATIONS, epsi);
+        if (extrinsic_est_en)
+        {
+            kf.init_dyn_share(get_f, df_dx, df_dw, h_share_model, NUM_MAX_ITERATIONS, epsi);
+            kf.init_sparse_propagation(df_dx_mul<state_ikfom>, df_dw_cov<state_ikfom>);
+        }
+        else
+        {
+            /*** the extrinsic is a constant: run the 17-DoF filter and keep it out of the state ***/
+            fixed_offset_R_L_I = Lidar_R_wrt_IMU;
+            fixed_offset_T_L_I = Lidar_T_wrt_IMU;
+            kf_fixed.init_dyn_share(get_f, df_dx, df_dw, h_share_model, NUM_MAX_ITERATIONS, epsi);
+            kf_fixed.init_sparse_propagation(df_dx_mul<state_ikfom_fixed>, df_dw_cov<state_ikfom_fixed>);
+        }
+        kf_max_iter = NUM_MAX_ITERATIONS;
+
+        /*** localization: the prior map, a PCD file or a map snapshot, replaces mapping ***/
+        if (localization_en)
+        {
+            double load_begin = omp_get_wtime();
+            PointVector points;
+            bool is_pcd = prior_map_path.size() > 4 && prior_map_path.compare(prior_map_path.size() - 4, 4, ".pcd") == 0;
+            if (is_pcd)
+            {
+                PointCloudXYZI::Ptr prior_cloud(new PointCloudXYZI());
+                if (pcl::io::loadPCDFile<PointType>(prior_map_path, *prior_cloud) == 0)
+                {
+                    downSizeFilterMap.setInputCloud(prior_cloud);
+                    downSizeFilterMap.filter(*prior_cloud);
+                    points.assign(prior_cloud->points.begin(), prior_cloud->points.end());
+                }
+            }
+            else
+            {
+                MapSnapshotReader snapshot;
+                if (snapshot.open(prior_map_path)) points.assign(snapshot.points(), snapshot.points() + snapshot.point_num());
+            }
+            if (points.size() > 5)
+            {
+                prior_map.set_param(prior_map_tile);
+                prior_map.set_points(points);
+                init_pose_pending = true;
+                reloc_pending = reloc_en;
+                relocalizer.set_param(reloc_radius, reloc_step, reloc_yaw_step * PI_M / 180.0, reloc_fine_num, reloc_threads);
+                RCLCPP_INFO(this->get_logger(), "Localization in a prior map of %ld points from %s, loaded in %.3f s", long(points.size()), prior_map_path.c_str(), omp_get_wtime() - load_begin);
+            }
+            else
+            {
+                RCLCPP_WARN(this->get_logger(), "Can not load prior map %s, falling back to mapping", prior_map_path.c_str());
+                localization_en = false;
+            }
+            if (localization_en && (snapshot_load_en || map_tile_en))
+            {
+                RCLCPP_WARN(this->get_logger(), "map_snapshot.load_en and mapping.map_tile_en are ignored in localization mode");
+                snapshot_load_en = map_tile_en = false;
+            }
+        }
+
+        /*** a snapshot holds the tree and the parked points, not the tiles on disk, which the next run starts over ***/
+        if (snapshot_save_en && map_tile_en)
+        {
+            RCLCPP_ERROR(this->get_logger(), "map_snapshot.save_en can not be used with mapping.map_tile_en, the snapshot would miss the tiled map; snapshots disabled");
+            snapshot_save_en = false;
+        }
+
+        /*** bulk-load the map of the last run, its pose is applied once the IMU is initialized ***/
+        if (snapshot_load_en)
+        {
+            MapSnapshotReader snapshot;
+            if (snapshot.open(snapshot_path) && snapshot.point_num() > 5)
+            {
+                double load_begin = omp_get_wtime();
+                PointVector points(snapshot.points(), snapshot.points() + snapshot.point_num());
+                ikdtree.set_downsample_param(filter_size_map_min);
+                ikdtree.Build(points);
+                if (plane_cache_en) plane_cache.add_points(points);
+                if (fov_cull_en) fov_culler.add_points(points);
+                snapshot.get_state(snapshot_state);
+                snapshot_pose_pending = true;
+                RCLCPP_INFO(this->get_logger(), "Loaded %ld map points from %s in %.3f s", long(points.size()), snapshot_path.c_str(), omp_get_wtime() - load_begin);
+            }
+            else RCLCPP_WARN(this->get_logger(), "No map snapshot loaded: %s", snapshot.error().empty() ? "too few points" : snapshot.error().c_str());
+        }
 
         data_seq = 0;
         uint32_t LcFreqcount = 1;
@@ -964,7 +1997,21 @@ public:
         //     cout << "~~~~"<<ROOT_DIR<<" doesn't exist" << endl;
 
         /*** ROS subscribe initialization ***/
+#ifdef LIVOX_ROS_DRIVER2_EN
+        if (livox_custom_msg)
+            sub_pcl_livox_ = this->create_subscription<livox_ros_driver2::msg::CustomMsg>(lid_topic, 20, std::bind(&LaserMappingNode::livox_pcl_cbk, this, std::placeholders::_1));
+        else
+            sub_pcl_pc_ = this->create_subscription<sensor_msgs::msg::PointCloud2>(lid_topic, 20, std::bind(&LaserMappingNode::standard_pcl_cbk, this, std::placeholders::_1));
+#else
+        if (livox_custom_msg)
+            RCLCPP_WARN(this->get_logger(), "Built without livox_ros_driver2, subscribing %s as PointCloud2", lid_topic.c_str());
         sub_pcl_pc_ = this->create_subscription<sensor_msgs::msg::PointCloud2>(lid_topic, 20, std::bind(&LaserMappingNode::standard_pcl_cbk, this, std::placeholders::_1));
+#endif
+        for (int k = 1; k <= extra_lidar_num; k++)
+        {
+            sub_extra_pcl_.push_back(this->create_subscription<sensor_msgs::msg::PointCloud2>(extra_lid_topics[k - 1], 20,
+                [this, k](sensor_msgs::msg::PointCloud2::UniquePtr msg) { extra_pcl_cbk(k, std::move(msg)); }));
+        }
         sub_imu_ = this->create_subscription<sensor_msgs::msg::Imu>(imu_topic, 10, imu_cbk);
         sub_keyframes_ = this->create_subscription<nav_msgs::msg::Path>(keyframe_topic, 20, keyFrame_cbk);
         sub_keyframes_id_ = this->create_subscription<std_msgs::msg::UInt32>(keyframe_id_topic, 20, keyFrameId_cbk);
@@ -979,6 +2026,8 @@ public:
         pubOdomAftMapped_ = this->create_publisher<nav_msgs::msg::Odometry>("/Odometry", 20);
         pubPath_ = this->create_publisher<nav_msgs::msg::Path>("/path", 20);
         pubPathUpdated_ = this->create_publisher<nav_msgs::msg::Path>("/path_updated", 20);
+        pubDeadlineMiss_ = this->create_publisher<std_msgs::msg::Float32>("/deadline_miss_rate", 20);
+        pubOdomLag_ = this->create_publisher<std_msgs::msg::Float32>("/odometry_lag", 20);
         pubKeyFramesMap_ = this->create_publisher<sensor_msgs::msg::PointCloud2>("/keyframes_map", 20);
 
         tf_broadcaster_ = std::make_unique<tf2_ros::TransformBroadcaster>(*this);
@@ -995,6 +2044,7 @@ public:
         map_pub_timer_ = rclcpp::create_timer(this, this->get_clock(), map_period_ms, std::bind(&LaserMappingNode::map_publish_callback, this));
 
         map_save_srv_ = this->create_service<std_srvs::srv::Trigger>("map_save", std::bind(&LaserMappingNode::map_save_callback, this, std::placeholders::_1, std::placeholders::_2));
+        map_snapshot_srv_ = this->create_service<std_srvs::srv::Trigger>("map_snapshot_save", std::bind(&LaserMappingNode::map_snapshot_callback, this, std::placeholders::_1, std::placeholders::_2));
 
         // init fusion buffer
         FusionLaserPointBuffer.resize(FusionBufferSize);
@@ -1005,6 +2055,17 @@ public:
 
     ~LaserMappingNode()
     {
+        if (map_thread.joinable())
+        {
+            {
+                lock_guard<mutex> lock(mtx_map_insert);
+                map_thread_exit = true;
+            }
+            sig_map_insert.notify_all();
+            map_thread.join();
+        }
+        map_tiles.stop();
+        snapshot_writer.stop();
         // fout_out.close();
         // fout_pre.close();
         // fclose(fp);
@@ -1054,8 +2115,30 @@ private:
             svd_time   = 0;
             t0 = omp_get_wtime();
 
-            p_imu->Process(Measures, kf, feats_undistort);
-            state_point = kf.get_x();
+            if (last_scan_beg_time > 0 && Measures.lidar_beg_time > last_scan_beg_time)
+            {
+                scan_period = 0.9 * scan_period + 0.1 * (Measures.lidar_beg_time - last_scan_beg_time);
+            }
+            last_scan_beg_time = Measures.lidar_beg_time;
+
+            if (extrinsic_est_en) p_imu->Process(Measures, kf, feats_undistort);
+            else p_imu->Process(Measures, kf_fixed, feats_undistort);
+            state_point = kf_get_x();
+            if (snapshot_pose_pending && p_imu->imu_init_done())
+            {
+                /*** resume where the snapshot was taken, keeping the freshly estimated biases ***/
+                state_point.pos = snapshot_state.pos;
+                state_point.rot = snapshot_state.rot;
+                state_point.grav = snapshot_state.grav;
+                state_point.vel.setZero();
+                kf_change_x(state_point);
+                snapshot_pose_pending = false;
+            }
+            if (init_pose_pending && p_imu->imu_init_done())
+            {
+                kf_set_start_pose(V3D(init_pose[0], init_pose[1], init_pose[2]), M3D(Eigen::AngleAxisd(init_pose[3] * PI_M / 180.0, V3D::UnitZ())));
+                init_pose_pending = false;
+            }
             pos_lid = state_point.pos + state_point.rot * state_point.offset_T_L_I;
 
             if (feats_undistort->empty() || (feats_undistort == NULL))
@@ -1070,7 +2153,7 @@ private:
             if(LcFreqcount % updateFrequency == 0 ){
                 LcFreqcount = 1;
                 if(debug_print) std::cout << "updateState: " << updateState << std::endl;
-                if(recontructKdTree && pathKeyFrames.poses.size() > 20){
+                if(recontructKdTree && !localization_en && pathKeyFrames.poses.size() > 20){
                     if(debug_print) std::cout << "Reconstruct KdTree done " << std::endl;
                     if(debug_print) std::cout << "pathKeyFrames.poses.size(): " << pathKeyFrames.poses.size() << std::endl;
                     /*** 所有关键帧的地图 ***/
@@ -1168,14 +2251,25 @@ private:
                     downSizeFilterMap.setInputCloud(keyFramesSubmap);
                     downSizeFilterMap.filter(*keyFramesSubmap);
 
+                    map_insert_wait();
                     ikdtree.reconstruct(keyFramesSubmap->points);
+                    if (plane_cache_en)
+                    {
+                        plane_cache.clear();
+                        plane_cache.add_points(keyFramesSubmap->points);
+                    }
+                    if (fov_cull_en)
+                    {
+                        fov_culler.reset();
+                        fov_culler.add_points(keyFramesSubmap->points);
+                    }
                 }
             }
 
             // update status
             if(updateState)
             {
-                state_ikfom state_updated = kf.get_x();
+                state_ikfom state_updated = kf_get_x();
                 Eigen::Isometry3d lastPose(state_updated.rot);
                 lastPose.pretranslate(state_updated.pos);
 
@@ -1194,19 +2288,13 @@ private:
                 Eigen::Vector3d lastPoseQuatPos( lastPose.translation() );
                 state_updated.rot = lastPoseQuat;
                 state_updated.pos = lastPoseQuatPos;
-                kf.change_x(state_updated);
+                kf_change_x(state_updated);
 
-                esekfom::esekf<state_ikfom, 12, input_ikfom>::cov P_updated = kf.get_P();  // 获取当前的状态估计的协方差矩阵
-                P_updated.setIdentity();
+                // 将状态的协方差矩阵重置为初始值
                 //QUESTION: 状态的协方差矩阵是否要更新为一个比较的小的值？ 
                 // init_P(0,0) = init_P(1,1) = init_P(2,2) = 0.00001; 
                 // init_P(3,3) = init_P(4,4) = init_P(5,5) = 0.00001;
-                P_updated(6,6) = P_updated(7,7) = P_updated(8,8) = 0.00001;
-                P_updated(9,9) = P_updated(10,10) = P_updated(11,11) = 0.00001;
-                P_updated(15,15) = P_updated(16,16) = P_updated(17,17) = 0.0001;
-                P_updated(18,18) = P_updated(19,19) = P_updated(20,20) = 0.001;
-                P_updated(21,21) = P_updated(22,22) = 0.00001; 
-                kf.change_P(P_updated);
+                kf_reset_cov();
 
                 msg_body_pose_updated.pose.position.x = state_updated.pos(0);
                 msg_body_pose_updated.pose.position.y = state_updated.pos(1);
@@ -1226,14 +2314,31 @@ private:
             }
             LcFreqcount++;
             
-            /*** Segment the map in lidar FOV ***/
-            lasermap_fov_segment();
-
             /*** downsample the feature points in a scan ***/
             downSizeFilterSurf.setInputCloud(feats_undistort);
             downSizeFilterSurf.filter(*feats_down_body);
+
+            /*** the previous frame's points are in the map from here on ***/
+            map_insert_wait();
+
+            /*** Segment the map in lidar FOV ***/
+            lasermap_fov_segment();
+            map_tile_prefetch();
+            lasermap_fov_cull();
+            if(debug_print && map_tile_en && (map_tile_saved > 0 || map_tile_loaded > 0))
+                RCLCPP_INFO(this->get_logger(), "Map tiles: %d points saved, %d loaded, %ld stored, %d prefetch misses", map_tile_saved, map_tile_loaded, map_tiles.stored_points(), map_tiles.prefetch_misses());
+            if(debug_print && fov_cull_en) RCLCPP_INFO(this->get_logger(), "FOV cull: %d points moved, %d parked", fov_cull_moved, fov_culler.parked_points());
             t1 = omp_get_wtime();
             feats_down_size = feats_down_body->points.size();
+            if (reloc_pending && ikdtree.Root_Node != nullptr && feats_down_size > 5)
+            {
+                RelocResult reloc;
+                bool found = relocalize(reloc);
+                if (found) RCLCPP_INFO(this->get_logger(), "Relocalized at (%.2f, %.2f, %.2f), %.0f%% inliers, in %.3f s", reloc.t(0), reloc.t(1), reloc.t(2), reloc.inlier_ratio * 100.0, omp_get_wtime() - t1);
+                else RCLCPP_WARN(this->get_logger(), "Relocalization failed (%.0f%% inliers), starting from init_pose", reloc.inlier_ratio * 100.0);
+                reloc_pending = false;
+                t1 = omp_get_wtime();
+            }
             /*** initialize the map kdtree ***/
             if(ikdtree.Root_Node == nullptr)
             {
@@ -1247,6 +2352,8 @@ private:
                         pointBodyToWorld(&(feats_down_body->points[i]), &(feats_down_world->points[i]));
                     }
                     ikdtree.Build(feats_down_world->points);
+                    if (plane_cache_en) plane_cache.add_points(feats_down_world->points);
+                    if (fov_cull_en) fov_culler.add_points(feats_down_world->points);
                 }
                 return;
             }
@@ -1261,7 +2368,18 @@ private:
                 return;
             }
             
-            normvec->resize(feats_down_size);
+            feats_match_size = feats_down_size;
+            if (point_select_en) select_feats_down();
+            if (deadline_en) subsample_feats_down(plan_update_budget(t0, epsi[0]));
+            if (stationary_en)
+            {
+                stationary = detect_stationary(Measures, state_point.vel);
+                // no iteration after the first evaluation: one measurement evaluation per stationary frame
+                if (stationary) kf_set_max_iter(0);
+                else if (!deadline_en) kf_set_max_iter(NUM_MAX_ITERATIONS);
+            }
+
+            plane_matches.resize(feats_down_size);
             feats_down_world->resize(feats_down_size);
 
             V3D ext_euler = SO3ToEuler(state_point.offset_R_L_I);
@@ -1277,7 +2395,15 @@ private:
             }
 
             pointSearchInd_surf.resize(feats_down_size);
-            Nearest_Points.resize(feats_down_size);
+            nearest_flat.resize(feats_down_size * NUM_MATCH_POINTS);
+            nearest_num.assign(feats_down_size, 0);
+            nearest_kth_dis.resize(feats_down_size);
+            if (plane_cache_en) cached_plane.resize(feats_down_size);
+            search_skip.resize(feats_down_size);
+            /*** updates of one or two measurement evaluations match the full scan throughout, the last Jacobian gives the posterior covariance ***/
+            if (pyramid_en && kf_max_iter > 1) build_coarse_level();
+            else pyramid_coarse = false;
+            h_model_calls = 0;
             int  rematch_num = 0;
             bool nearest_search_en = true; //
 
@@ -1286,8 +2412,17 @@ private:
             /*** iterated state estimation ***/
             double t_update_start = omp_get_wtime();
             double solve_H_time = 0;
-            kf.update_iterated_dyn_share_modified(LASER_POINT_COV, solve_H_time);
-            state_point = kf.get_x();
+            if (extrinsic_est_en) kf.update_iterated_dyn_share_fixed<12>(LASER_POINT_COV, solve_H_time);
+            else kf_fixed.update_iterated_dyn_share_fixed<6>(LASER_POINT_COV, solve_H_time);
+            if (stationary) kf_zero_velocity_update(stationary_vel_std);
+            // a still frame that ran the kNN search: before the stop is declared, or its first frame when none came before
+            if (stationary_count > 0 && (!stationary || still_nbr_slot.empty())) still_nbr_store();
+            if (point_select_en)
+            {
+                point_selector.update_normals(feats_down_world->points.data(), plane_matches.nx.data(), plane_matches.ny.data(),
+                                              plane_matches.nz.data(), effct_idx.data(), effct_feat_num);
+            }
+            state_point = kf_get_x();
             euler_cur = SO3ToEuler(state_point.rot);
             pos_lid = state_point.pos + state_point.rot * state_point.offset_T_L_I;
             geoQuat.x = state_point.rot.coeffs()[0];
@@ -1296,14 +2431,47 @@ private:
             geoQuat.w = state_point.rot.coeffs()[3];
 
             double t_update_end = omp_get_wtime();
+            {
+                int iter_num;
+                double dx_first_norm, dx_rate;
+                kf_iter_stats(iter_num, dx_first_norm, dx_rate);
+                if (iter_num > 0)
+                {
+                    double cost = (t_update_end - t_update_start) / (double(feats_match_size) * iter_num);
+                    update_cost_per_pt = update_cost_per_pt > 0.0 ? 0.9 * update_cost_per_pt + 0.1 * cost : cost;
+                }
+            }
 
             /******* Publish odometry *******/
             publish_odometry(pubOdomAftMapped_, tf_broadcaster_);
+            std_msgs::msg::Float32 odom_lag;
+            odom_lag.data = this->now().seconds() - Measures.lidar_beg_time;
+            pubOdomLag_->publish(odom_lag);
 
             /*** add the feature points to map kdtree ***/
             t3 = omp_get_wtime();
-            map_incremental();
+            if (!stationary) map_incremental();
+            else add_point_size = 0;
             t5 = omp_get_wtime();
+
+            /*** a frame misses its deadline when it takes longer than the scan period; the rate is over the last deadline_window frames ***/
+            deadline_misses.push_back(t5 - t0 > scan_period);
+            deadline_miss_num += deadline_misses.back();
+            if (int(deadline_misses.size()) > deadline_window)
+            {
+                deadline_miss_num -= deadline_misses.front();
+                deadline_misses.pop_front();
+            }
+            std_msgs::msg::Float32 deadline_miss_rate;
+            deadline_miss_rate.data = float(deadline_miss_num) / deadline_misses.size();
+            pubDeadlineMiss_->publish(deadline_miss_rate);
+
+            if (snapshot_save_en && snapshot_interval > 0.0 && lidar_end_time - last_snapshot_time >= snapshot_interval)
+            {
+                if (last_snapshot_time < 0.0) last_snapshot_time = lidar_end_time;
+                else map_snapshot_save();
+            }
+            if (snapshot_writer.take_failures() > 0) RCLCPP_WARN(this->get_logger(), "Failed to write map snapshot %s", snapshot_path.c_str());
             
             /******* Publish points *******/
             if (path_en)                         publish_path(pubPath_);
@@ -1318,6 +2486,7 @@ private:
             if (runtime_pos_log)
             {
                 frame_num ++;
+                map_insert_wait();   // the sizes and insertion time below are the map thread's
                 kdtree_size_end = ikdtree.size();
                 aver_time_consu = aver_time_consu * (frame_num - 1) / frame_num + (t5 - t0) / frame_num;
                 aver_time_icp = aver_time_icp * (frame_num - 1)/frame_num + (t_update_end - t_update_start) / frame_num;
@@ -1416,7 +2585,20 @@ private:
         }
     }
 
-    void standard_pcl_cbk(const sensor_msgs::msg::PointCloud2::UniquePtr msg) 
+    void map_snapshot_callback(std_srvs::srv::Trigger::Request::ConstSharedPtr req, std_srvs::srv::Trigger::Response::SharedPtr res)
+    {
+        if (map_tile_en)
+        {
+            res->success = false;
+            res->message = "Map snapshot refused: with mapping.map_tile_en the map outside the local cube is on disk tiles and would be missing.";
+            return;
+        }
+        RCLCPP_INFO(this->get_logger(), "Saving map snapshot to %s...", snapshot_path.c_str());
+        res->success = map_snapshot_save();
+        res->message = res->success ? "Map snapshot queued, written in the background." : "Map snapshot failed: the map is empty.";
+    }
+
+    void standard_pcl_cbk(sensor_msgs::msg::PointCloud2::UniquePtr msg) 
     {
         mtx_buffer.lock();
         scan_count ++;
@@ -1426,6 +2608,7 @@ private:
         {
             std::cerr << "lidar loop back, clear buffer" << std::endl;
             lidar_buffer.clear();
+            lidar_merger.clear();
             reset_pos();
         }
         if (is_first_lidar)
@@ -1433,23 +2616,90 @@ private:
             is_first_lidar = false;
         }
 
+        if (extra_lidar_num > 0)
+        {
+            lidar_raw[0].emplace_back(std::move(msg), cur_time);
+            merge_lidar_scans();
+        }
+        else
+        {
+            PointCloudXYZI::Ptr  ptr(new PointCloudXYZI());
+            p_pre->process(msg, ptr);
+            if(pubdeskewLaserCloud_->get_subscription_count() > 0)
+            {
+                sensor_msgs::msg::PointCloud2 deskewed_msg;
+                pcl::toROSMsg(p_pre->pl_full, deskewed_msg);
+                deskewed_msg.header.stamp = get_ros_time(lidar_end_time);
+                deskewed_msg.header.frame_id = lidar_frame_id;
+                pubdeskewLaserCloud_->publish(deskewed_msg);
+            }
+            push_lidar_scan(ptr, cur_time);
+        }
+        int drop_num_before = lidar_drop_num;
+        bound_lidar_queue();
+        if (lidar_drop_num > drop_num_before)
+        {
+            RCLCPP_WARN_THROTTLE(this->get_logger(), *this->get_clock(), 1000, "Mapping falls behind, %d lidar scans dropped so far", lidar_drop_num);
+        }
+        last_timestamp_lidar = cur_time;
+        s_plot11[scan_count] = omp_get_wtime() - preprocess_start_time;
+        mtx_buffer.unlock();
+        sig_buffer.notify_all();
+    }
+
+#ifdef LIVOX_ROS_DRIVER2_EN
+    void livox_pcl_cbk(const livox_ros_driver2::msg::CustomMsg::UniquePtr msg)
+    {
+        mtx_buffer.lock();
+        scan_count ++;
+        double cur_time = get_time_sec(msg->header.stamp);
+        double preprocess_start_time = omp_get_wtime();
+        if (!is_first_lidar && cur_time < last_timestamp_lidar)
+        {
+            std::cerr << "lidar loop back, clear buffer" << std::endl;
+            lidar_buffer.clear();
+            lidar_merger.clear();
+            reset_pos();
+        }
+        is_first_lidar = false;
+
         PointCloudXYZI::Ptr  ptr(new PointCloudXYZI());
         p_pre->process(msg, ptr);
-        if(pubdeskewLaserCloud_->get_subscription_count() > 0)
+        if (extra_lidar_num > 0)
         {
-            sensor_msgs::msg::PointCloud2 deskewed_msg;
-            pcl::toROSMsg(p_pre->pl_full, deskewed_msg);
-            deskewed_msg.header.stamp = get_ros_time(lidar_end_time);
-            deskewed_msg.header.frame_id = lidar_frame_id;
-            pubdeskewLaserCloud_->publish(deskewed_msg);
+            lidar_merger.push(0, ptr, cur_time);
+            merge_lidar_scans();
+        }
+        else push_lidar_scan(ptr, cur_time);
+        int drop_num_before = lidar_drop_num;
+        bound_lidar_queue();
+        if (lidar_drop_num > drop_num_before)
+        {
+            RCLCPP_WARN_THROTTLE(this->get_logger(), *this->get_clock(), 1000, "Mapping falls behind, %d lidar scans dropped so far", lidar_drop_num);
         }
-        lidar_buffer.push_back(ptr);
-        time_buffer.push_back(cur_time);
         last_timestamp_lidar = cur_time;
         s_plot11[scan_count] = omp_get_wtime() - preprocess_start_time;
         mtx_buffer.unlock();
         sig_buffer.notify_all();
     }
+#endif
+
+    /*** scans of the extra LiDARs wait raw, to be preprocessed together with the next primary scan ***/
+    void extra_pcl_cbk(int idx, sensor_msgs::msg::PointCloud2::UniquePtr msg)
+    {
+        mtx_buffer.lock();
+        double cur_time = get_time_sec(msg->header.stamp);
+        lidar_raw[idx].emplace_back(std::move(msg), cur_time);
+        // the primary LiDAR is silent: keep about the last second of scans
+        while (int(lidar_raw[idx].size()) > max(1, p_pre->SCAN_RATE)) lidar_raw[idx].pop_front();
+        if (lidar_merger.primary_waiting())
+        {
+            merge_lidar_scans();
+            bound_lidar_queue();
+        }
+        mtx_buffer.unlock();
+        sig_buffer.notify_all();
+    }
 
 
 private:
@@ -1465,9 +2715,15 @@ private:
     rclcpp::Publisher<nav_msgs::msg::Odometry>::SharedPtr pubOdomAftMapped_;
     rclcpp::Publisher<nav_msgs::msg::Path>::SharedPtr pubPath_;
     rclcpp::Publisher<nav_msgs::msg::Path>::SharedPtr pubPathUpdated_;
+    rclcpp::Publisher<std_msgs::msg::Float32>::SharedPtr pubDeadlineMiss_;
+    rclcpp::Publisher<std_msgs::msg::Float32>::SharedPtr pubOdomLag_;
 
     rclcpp::Subscription<sensor_msgs::msg::Imu>::SharedPtr sub_imu_;
     rclcpp::Subscription<sensor_msgs::msg::PointCloud2>::SharedPtr sub_pcl_pc_;
+#ifdef LIVOX_ROS_DRIVER2_EN
+    rclcpp::Subscription<livox_ros_driver2::msg::CustomMsg>::SharedPtr sub_pcl_livox_;
+#endif
+    vector<rclcpp::Subscription<sensor_msgs::msg::PointCloud2>::SharedPtr> sub_extra_pcl_;
     rclcpp::Subscription<nav_msgs::msg::Path>::SharedPtr sub_keyframes_;
     rclcpp::Subscription<std_msgs::msg::UInt32>::SharedPtr sub_keyframes_id_;
 
@@ -1479,6 +2735,7 @@ private:
     rclcpp::TimerBase::SharedPtr timer_;
     rclcpp::TimerBase::SharedPtr map_pub_timer_;
     rclcpp::Service<std_srvs::srv::Trigger>::SharedPtr map_save_srv_;
+    rclcpp::Service<std_srvs::srv::Trigger>::SharedPtr map_snapshot_srv_;
 
     int effect_feat_num = 0, frame_num = 0;
     double deltaT, deltaR, aver_time_consu = 0, aver_time_icp = 0, aver_time_match = 0, aver_time_incre = 0, aver_time_solve = 0, aver_time_const_H_time = 0;
@@ -1505,6 +2762,15 @@ int main(int argc, char** argv)
         if(debug_print) std::cout << "Save FAST-LIO2 trajectory !!" << std::endl;  
     }
 
+    /**************** save map snapshot ****************/
+    if (snapshot_save_en)
+    {
+        bool ok = map_snapshot_save();
+        snapshot_writer.stop();
+        ok = snapshot_writer.take_failures() == 0 && ok;
+        cout << "map snapshot saved to " << snapshot_path << (ok ? "" : " failed") << endl;
+    }
+
     /**************** save map ****************/
     /* Make sure you have enough memories to save the map */
     if (pcl_wait_save->size() > 0 && pcd_save_en)
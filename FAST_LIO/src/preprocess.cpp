@@ -1,6 +1,7 @@
 #include "preprocess.h"
 
 #include <pcl/common/common.h>
+#include <string.h>
 
 #define RETURN0 0x00
 #define RETURN0AND1 0x10
@@ -25,6 +26,8 @@ Preprocess::Preprocess() : feature_enabled(0), lidar_type(AVIA), blind(0.01), po
   smallp_intersect = 172.5;
   smallp_ratio = 1.2;
   given_offset_time = false;
+  row_stride = 1;
+  col_stride = 1;
 
   jump_up_limit = cos(jump_up_limit / 180 * M_PI);
   jump_down_limit = cos(jump_down_limit / 180 * M_PI);
@@ -67,6 +70,10 @@ void Preprocess::process(const sensor_msgs::msg::PointCloud2::UniquePtr &msg, Po
 
   switch (lidar_type)
   {
+    case OUST64:
+      oust64_handler(msg);
+      break;
+
     case VELO16:
       velodyne_handler(msg);
       break;
@@ -82,6 +89,94 @@ void Preprocess::process(const sensor_msgs::msg::PointCloud2::UniquePtr &msg, Po
   *pcl_out = pl_surf;
 }
 
+#ifdef LIVOX_ROS_DRIVER2_EN
+void Preprocess::process(const livox_ros_driver2::msg::CustomMsg::UniquePtr &msg, PointCloudXYZI::Ptr &pcl_out)
+{
+  livox_handler(msg);
+  *pcl_out = pl_surf;
+}
+#endif
+
+void Preprocess::oust64_handler(const sensor_msgs::msg::PointCloud2::UniquePtr &msg)
+{
+  pl_surf.clear();
+  pl_corn.clear();
+  pl_full.clear();
+
+  /*** read the fields in place: the organized layout makes the pcl conversion a full copy for nothing ***/
+  int off_x = -1, off_y = -1, off_z = -1, off_i = -1, off_t = -1, off_r = -1;
+  for (const auto &field : msg->fields)
+  {
+    if (field.name == "x" && field.datatype == sensor_msgs::msg::PointField::FLOAT32) off_x = field.offset;
+    else if (field.name == "y" && field.datatype == sensor_msgs::msg::PointField::FLOAT32) off_y = field.offset;
+    else if (field.name == "z" && field.datatype == sensor_msgs::msg::PointField::FLOAT32) off_z = field.offset;
+    else if (field.name == "intensity" && field.datatype == sensor_msgs::msg::PointField::FLOAT32) off_i = field.offset;
+    else if (field.name == "t" && field.datatype == sensor_msgs::msg::PointField::UINT32) off_t = field.offset;
+    else if (field.name == "range" && field.datatype == sensor_msgs::msg::PointField::UINT32) off_r = field.offset;
+  }
+  if (off_x < 0 || off_y < 0 || off_z < 0 || off_t < 0 || off_r < 0)
+  {
+    static bool warned = false;
+    if (!warned) printf("Ouster cloud without float x, y, z and uint32 t, range fields, point times are lost\n");
+    warned = true;
+    default_handler(msg);
+    return;
+  }
+
+  const uint rows = msg->height, cols = msg->width;
+  if (rows == 0 || cols == 0)
+    return;
+  pl_surf.reserve(size_t(rows / row_stride + 1) * (cols / col_stride + 1));
+  pl_full.reserve(pl_surf.points.capacity());
+  if (feature_enabled)
+  {
+    for (int i = 0; i < N_SCANS; i++)
+    {
+      pl_buff[i].clear();
+      pl_buff[i].reserve(cols / col_stride + 1);
+    }
+  }
+
+  const uint8_t *data = msg->data.data();
+  const uint32_t blind_mm = blind * 1000.0;   // range is in mm
+  auto read_u32 = [](const uint8_t *p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; };
+  auto read_f32 = [](const uint8_t *p) { float v; memcpy(&v, p, sizeof(v)); return v; };
+
+  for (uint col = 0; col < cols; col += col_stride)
+  {
+    /*** all the points of a column are fired together, their time is read once ***/
+    const float col_time = read_u32(data + col * msg->point_step + off_t) * time_unit_scale;  // units: ms
+    for (uint row = 0; row < rows; row += row_stride)
+    {
+      const uint8_t *pt = data + row * msg->row_step + col * msg->point_step;
+      const uint32_t range = read_u32(pt + off_r);
+      if (range <= blind_mm)
+        continue;
+
+      PointType added_pt;
+      added_pt.normal_x = 0;
+      added_pt.normal_y = 0;
+      added_pt.normal_z = 0;
+      added_pt.x = read_f32(pt + off_x);
+      added_pt.y = read_f32(pt + off_y);
+      added_pt.z = read_f32(pt + off_z);
+      added_pt.intensity = off_i >= 0 ? read_f32(pt + off_i) : 0.0f;
+      added_pt.curvature = rows > 1 ? col_time : read_u32(pt + off_t) * time_unit_scale;
+      pl_full.points.push_back(added_pt);
+
+      if (!feature_enabled)
+        pl_surf.points.push_back(added_pt);
+      else if (int(row) < N_SCANS)
+        pl_buff[row].points.push_back(added_pt);
+    }
+  }
+
+  if (feature_enabled)
+  {
+    give_feature_lines();
+  }
+}
+
 void Preprocess::velodyne_handler(const sensor_msgs::msg::PointCloud2::UniquePtr &msg)
 {
   pl_surf.clear();
@@ -179,27 +274,7 @@ void Preprocess::velodyne_handler(const sensor_msgs::msg::PointCloud2::UniquePtr
       pl_buff[layer].points.push_back(added_pt);
     }
 
-    for (int j = 0; j < N_SCANS; j++)
-    {
-      PointCloudXYZI& pl = pl_buff[j];
-      int linesize = pl.size();
-      if (linesize < 2)
-        continue;
-      vector<orgtype>& types = typess[j];
-      types.clear();
-      types.resize(linesize);
-      linesize--;
-      for (uint i = 0; i < linesize; i++)
-      {
-        types[i].range = sqrt(pl[i].x * pl[i].x + pl[i].y * pl[i].y);
-        vx = pl[i].x - pl[i + 1].x;
-        vy = pl[i].y - pl[i + 1].y;
-        vz = pl[i].z - pl[i + 1].z;
-        types[i].dista = vx * vx + vy * vy + vz * vz;
-      }
-      types[linesize].range = sqrt(pl[linesize].x * pl[linesize].x + pl[linesize].y * pl[linesize].y);
-      give_feature(pl, types);
-    }
+    give_feature_lines();
   }
   else
   {
@@ -346,6 +421,70 @@ void Preprocess::mid360_handler(const sensor_msgs::msg::PointCloud2::UniquePtr &
   }
 }
 
+#ifdef LIVOX_ROS_DRIVER2_EN
+void Preprocess::livox_handler(const livox_ros_driver2::msg::CustomMsg::UniquePtr &msg)
+{
+  pl_surf.clear();
+  pl_corn.clear();
+  pl_full.clear();
+
+  uint plsize = std::min<size_t>(msg->point_num, msg->points.size());
+  if (plsize == 0)
+    return;
+  pl_surf.reserve(plsize);
+  pl_full.reserve(plsize);
+
+  if (feature_enabled)
+  {
+    for (int i = 0; i < N_SCANS; i++)
+    {
+      pl_buff[i].clear();
+      pl_buff[i].reserve(plsize);
+    }
+  }
+
+  /*** the driver stamps every point with its offset from the scan start (ns), no time reconstruction needed ***/
+  uint valid_num = 0;
+  for (uint i = 0; i < plsize; i++)
+  {
+    const livox_ros_driver2::msg::CustomPoint &pt = msg->points[i];
+    // first and strongest returns only, and no repeat of the previous point (dual return)
+    if (pt.line >= N_SCANS || ((pt.tag & 0x30) != 0x10 && (pt.tag & 0x30) != 0x00))
+      continue;
+    if (i > 0 && pt.x == msg->points[i - 1].x && pt.y == msg->points[i - 1].y && pt.z == msg->points[i - 1].z)
+      continue;
+
+    PointType added_pt;
+    added_pt.normal_x = 0;
+    added_pt.normal_y = 0;
+    added_pt.normal_z = 0;
+    added_pt.x = pt.x;
+    added_pt.y = pt.y;
+    added_pt.z = pt.z;
+    added_pt.intensity = pt.reflectivity;
+    added_pt.curvature = pt.offset_time / float(1000000);  // units: ms
+    pl_full.points.push_back(added_pt);
+
+    if (feature_enabled)
+    {
+      pl_buff[pt.line].points.push_back(added_pt);
+      continue;
+    }
+    valid_num ++;
+    if (valid_num % point_filter_num == 0 &&
+        added_pt.x * added_pt.x + added_pt.y * added_pt.y + added_pt.z * added_pt.z > (blind * blind))
+    {
+      pl_surf.points.push_back(added_pt);
+    }
+  }
+
+  if (feature_enabled)
+  {
+    give_feature_lines();
+  }
+}
+#endif
+
 void Preprocess::default_handler(const sensor_msgs::msg::PointCloud2::UniquePtr &msg)
 {
   pl_surf.clear();
@@ -378,7 +517,44 @@ void Preprocess::default_handler(const sensor_msgs::msg::PointCloud2::UniquePtr
   }
 }
 
-void Preprocess::give_feature(pcl::PointCloud<PointType>& pl, vector<orgtype>& types)
+void Preprocess::give_feature_lines()
+{
+  /*** lines are independent: each thread fills the features of its lines, joined in line order afterwards ***/
+#ifdef MP_EN
+  #pragma omp parallel for num_threads(MP_PROC_NUM) schedule(dynamic, 1)
+#endif
+  for (int j = 0; j < N_SCANS; j++)
+  {
+    PointCloudXYZI& pl = pl_buff[j];
+    pl_surf_line[j].clear();
+    pl_corn_line[j].clear();
+    int linesize = pl.size();
+    if (linesize < 2)
+      continue;
+    vector<orgtype>& types = typess[j];
+    types.clear();
+    types.resize(linesize);
+    linesize--;
+    for (uint i = 0; i < linesize; i++)
+    {
+      types[i].range = sqrt(pl[i].x * pl[i].x + pl[i].y * pl[i].y);
+      double vx = pl[i].x - pl[i + 1].x;
+      double vy = pl[i].y - pl[i + 1].y;
+      double vz = pl[i].z - pl[i + 1].z;
+      types[i].dista = vx * vx + vy * vy + vz * vz;
+    }
+    types[linesize].range = sqrt(pl[linesize].x * pl[linesize].x + pl[linesize].y * pl[linesize].y);
+    give_feature(pl, types, pl_surf_line[j], pl_corn_line[j]);
+  }
+
+  for (int j = 0; j < N_SCANS; j++)
+  {
+    pl_surf += pl_surf_line[j];
+    pl_corn += pl_corn_line[j];
+  }
+}
+
+void Preprocess::give_feature(pcl::PointCloud<PointType>& pl, vector<orgtype>& types, PointCloudXYZI& surf, PointCloudXYZI& corn)
 {
   int plsize = pl.size();
   int plsize2;
@@ -660,7 +836,7 @@ void Preprocess::give_feature(pcl::PointCloud<PointType>& pl, vector<orgtype>& t
         ap.z = pl[j].z;
         ap.intensity = pl[j].intensity;
         ap.curvature = pl[j].curvature;
-        pl_surf.push_back(ap);
+        surf.push_back(ap);
 
         last_surface = -1;
       }
@@ -669,7 +845,7 @@ void Preprocess::give_feature(pcl::PointCloud<PointType>& pl, vector<orgtype>& t
     {
       if (types[j].ftype == Edge_Jump || types[j].ftype == Edge_Plane)
       {
-        pl_corn.push_back(pl[j]);
+        corn.push_back(pl[j]);
       }
       if (last_surface != -1)
       {
@@ -687,7 +863,7 @@ void Preprocess::give_feature(pcl::PointCloud<PointType>& pl, vector<orgtype>& t
         ap.z /= (j - last_surface);
         ap.intensity /= (j - last_surface);
         ap.curvature /= (j - last_surface);
-        pl_surf.push_back(ap);
+        surf.push_back(ap);
       }
       last_surface = -1;
     }
@@ -712,6 +888,7 @@ int Preprocess::plane_judge(const PointCloudXYZI& pl, vector<orgtype>& types, ui
   // i_nex = i_cur;
 
   double two_dis;
+  double vx = 0, vy = 0, vz = 0;
   vector<double> disarr;
   disarr.reserve(20);
 
@@ -2,6 +2,9 @@
 #include <rclcpp/rclcpp.hpp>
 #include <pcl_conversions/pcl_conversions.h>
 #include <sensor_msgs/msg/point_cloud2.hpp>
+#ifdef LIVOX_ROS_DRIVER2_EN
+#include <livox_ros_driver2/msg/custom_msg.hpp>
+#endif
 
 using namespace std;
 
@@ -140,14 +143,19 @@ class Preprocess
   ~Preprocess();
   
   void process(const sensor_msgs::msg::PointCloud2::UniquePtr &msg, PointCloudXYZI::Ptr &pcl_out);
+#ifdef LIVOX_ROS_DRIVER2_EN
+  void process(const livox_ros_driver2::msg::CustomMsg::UniquePtr &msg, PointCloudXYZI::Ptr &pcl_out);
+#endif
   void set(bool feat_en, int lid_type, double bld, int pfilt_num);
 
   // sensor_msgs::PointCloud2::ConstPtr pointcloud;
   PointCloudXYZI pl_full, pl_corn, pl_surf;
   PointCloudXYZI pl_buff[128]; //maximum 128 line lidar
   vector<orgtype> typess[128]; //maximum 128 line lidar
+  PointCloudXYZI pl_surf_line[128], pl_corn_line[128]; // features of each line, filled in parallel
   float time_unit_scale;
   int lidar_type, point_filter_num, N_SCANS, SCAN_RATE, time_unit;
+  int row_stride, col_stride;   // decimation of organized clouds (Ouster), in rows and columns
   double blind;
   bool feature_enabled, given_offset_time;
   // ros::Publisher pub_full, pub_surf, pub_corn;
@@ -156,7 +164,11 @@ private:
   void velodyne_handler(const sensor_msgs::msg::PointCloud2::UniquePtr &msg);
   void mid360_handler(const sensor_msgs::msg::PointCloud2::UniquePtr &msg);
   void default_handler(const sensor_msgs::msg::PointCloud2::UniquePtr &msg);
-  void give_feature(PointCloudXYZI &pl, vector<orgtype> &types);
+#ifdef LIVOX_ROS_DRIVER2_EN
+  void livox_handler(const livox_ros_driver2::msg::CustomMsg::UniquePtr &msg);
+#endif
+  void give_feature_lines();
+  void give_feature(PointCloudXYZI &pl, vector<orgtype> &types, PointCloudXYZI &surf, PointCloudXYZI &corn);
   void pub_func(PointCloudXYZI &pl, const rclcpp::Time &ct);
   int  plane_judge(const PointCloudXYZI &pl, vector<orgtype> &types, uint i, uint &i_nex, Eigen::Vector3d &curr_direct);
   bool small_plane(const PointCloudXYZI &pl, vector<orgtype> &types, uint i_cur, uint &i_nex, Eigen::Vector3d &curr_direct);
@@ -170,5 +182,4 @@ private:
   double cos160;
   double edgea, edgeb;
   double smallp_intersect, smallp_ratio;
-  double vx, vy, vz;
 };
@@ -0,0 +1,164 @@
+// Counts the heap allocations of the matching path (batched kNN search into the flat neighbor buffers, then the
+// plane fit) over a steady-state frame. The map is a small stand-in tree whose Nearest_Search reuses the output
+// buffers like ikd-Tree's does, so only KnnBatch and the frame buffers are measured; ikd-Tree's own search heap is not.
+#include <gtest/gtest.h>
+#include <atomic>
+#include <random>
+#include <malloc.h>
+#include <common_lib.h>
+#include <knn_batch.h>
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t num, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void *__libc_memalign(size_t alignment, size_t size);
+
+namespace
+{
+std::atomic<bool> count_en(false);
+std::atomic<long> alloc_num(0);
+
+inline void count_alloc()
+{
+    if (count_en.load(std::memory_order_relaxed)) alloc_num.fetch_add(1, std::memory_order_relaxed);
+}
+}  // namespace
+
+/*** operator new and Eigen's aligned allocator both end in malloc, so counting the malloc family counts them all ***/
+extern "C" void *malloc(size_t size)
+{
+    count_alloc();
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t num, size_t size)
+{
+    count_alloc();
+    return __libc_calloc(num, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    count_alloc();
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    count_alloc();
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr == nullptr ? ENOMEM : 0;
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size)
+{
+    count_alloc();
+    return __libc_memalign(alignment, size);
+}
+
+namespace
+{
+
+/*** brute-force map with the Nearest_Search of KD_TREE<PointType>: sorted nearest first, output vectors reused ***/
+struct BruteForceMap
+{
+    PointVector points;
+
+    void Nearest_Search(PointType point, int k_nearest, PointVector &nearest, vector<float> &sq_dist, double max_dist = INFINITY)
+    {
+        nearest.clear();
+        sq_dist.clear();
+        for (const PointType &p : points)
+        {
+            float d = (p.x - point.x) * (p.x - point.x) + (p.y - point.y) * (p.y - point.y) + (p.z - point.z) * (p.z - point.z);
+            if (d > max_dist * max_dist || (int(sq_dist.size()) == k_nearest && d >= sq_dist.back())) continue;
+            int pos = std::upper_bound(sq_dist.begin(), sq_dist.end(), d) - sq_dist.begin();
+            if (int(sq_dist.size()) == k_nearest)
+            {
+                nearest.pop_back();
+                sq_dist.pop_back();
+            }
+            nearest.insert(nearest.begin() + pos, p);
+            sq_dist.insert(sq_dist.begin() + pos, d);
+        }
+    }
+};
+
+PointType make_point(float x, float y, float z)
+{
+    PointType p;
+    p.x = x; p.y = y; p.z = z;
+    p.intensity = 0.0f; p.curvature = 0.0f;
+    return p;
+}
+
+/*** the per-frame buffers of h_share_model, sized at the start of every frame ***/
+struct MatchBuffers
+{
+    PointVector     nearest_flat;
+    vector<int>     nearest_num;
+    vector<float>   nearest_kth_dis;
+    vector<uint8_t> search_skip;
+    vector<int>     plane_found;
+};
+
+int match_frame(KnnBatch &knn, BruteForceMap &map, const PointVector &scan, MatchBuffers &buf)
+{
+    const int n = scan.size();
+    buf.nearest_flat.resize(n * NUM_MATCH_POINTS);
+    buf.nearest_num.assign(n, 0);
+    buf.nearest_kth_dis.resize(n);
+    buf.search_skip.assign(n, 0);
+    buf.plane_found.assign(n, 0);
+    for (int i = 0; i < n; i += 7) buf.search_skip[i] = 1;
+
+    knn.search(map, scan.data(), n, NUM_MATCH_POINTS, 0.5, buf.nearest_flat.data(), buf.nearest_num.data(),
+               buf.nearest_kth_dis.data(), buf.search_skip.data());
+
+    #ifdef MP_EN
+        #pragma omp parallel for
+    #endif
+    for (int i = 0; i < n; i++)
+    {
+        if (buf.nearest_num[i] < NUM_MATCH_POINTS) continue;
+        VF(4) pabcd;
+        buf.plane_found[i] = esti_plane(pabcd, &buf.nearest_flat[i * NUM_MATCH_POINTS], 0.1f);
+    }
+    int found = 0;
+    for (int i = 0; i < n; i++) found += buf.plane_found[i];
+    return found;
+}
+
+}  // namespace
+
+TEST(MatchingAlloc, SteadyStateFrameDoesNotAllocate)
+{
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> u(-10.0f, 10.0f), noise(-0.01f, 0.01f);
+
+    BruteForceMap map;
+    for (int i = 0; i < 2000; i++) map.points.push_back(make_point(u(gen), u(gen), noise(gen)));          // ground
+    for (int i = 0; i < 2000; i++) map.points.push_back(make_point(10.0f + noise(gen), u(gen), u(gen)));  // wall
+
+    vector<PointVector> frames(4);
+    for (PointVector &scan : frames)
+    {
+        for (int i = 0; i < 500; i++) scan.push_back(make_point(u(gen), u(gen), noise(gen)));
+        for (int i = 0; i < 500; i++) scan.push_back(make_point(10.0f + noise(gen), u(gen), u(gen)));
+    }
+
+    KnnBatch knn;
+    MatchBuffers buf;
+    /*** the first frames size the per-thread and per-frame buffers ***/
+    for (int f = 0; f < 2; f++) ASSERT_GT(match_frame(knn, map, frames[f], buf), 0);
+
+    for (int f = 2; f < 4; f++)
+    {
+        alloc_num = 0;
+        count_en = true;
+        int found = match_frame(knn, map, frames[f], buf);
+        count_en = false;
+        EXPECT_GT(found, 0);
+        EXPECT_EQ(alloc_num.load(), 0) << "frame " << f;
+    }
+}
@@ -0,0 +1,90 @@
+// Checks that the block-sparse covariance propagation (df_dx_mul / df_dw_cov) gives the same covariance as the
+// dense F * P * F^T + G * Q * G^T of esekf::predict, on random states, inputs and covariances.
+#include <gtest/gtest.h>
+#include <random>
+#include <use-ikfom.hpp>
+
+namespace
+{
+
+template<typename S>
+void h_none(S &s, esekfom::dyn_share_datastruct<double> &ekfom_data) {}
+
+template<typename S>
+void random_state(std::mt19937 &gen, S &s)
+{
+    std::uniform_real_distribution<double> u(-1.0, 1.0);
+    s.pos = Eigen::Vector3d(10.0 * u(gen), 10.0 * u(gen), 10.0 * u(gen));
+    s.vel = Eigen::Vector3d(3.0 * u(gen), 3.0 * u(gen), 3.0 * u(gen));
+    s.bg  = Eigen::Vector3d(0.01 * u(gen), 0.01 * u(gen), 0.01 * u(gen));
+    s.ba  = Eigen::Vector3d(0.1 * u(gen), 0.1 * u(gen), 0.1 * u(gen));
+    s.rot = SO3(Eigen::Quaterniond(u(gen), u(gen), u(gen), u(gen)).normalized());
+    Eigen::Vector3d g(0.5 * u(gen), 0.5 * u(gen), -1.0);
+    s.grav = S2(g.normalized() * 9.81);
+}
+
+void random_offset(std::mt19937 &gen, state_ikfom &s)
+{
+    std::uniform_real_distribution<double> u(-1.0, 1.0);
+    s.offset_R_L_I = SO3(Eigen::Quaterniond(u(gen), u(gen), u(gen), u(gen)).normalized());
+    s.offset_T_L_I = Eigen::Vector3d(0.2 * u(gen), 0.2 * u(gen), 0.2 * u(gen));
+}
+
+void random_offset(std::mt19937 &gen, state_ikfom_fixed &s) {}
+
+template<typename S>
+void compare_propagation(unsigned seed)
+{
+    typedef esekfom::esekf<S, 12, input_ikfom> filter;
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> u(-1.0, 1.0);
+    double epsi[S::DOF];
+    std::fill(epsi, epsi + S::DOF, 0.001);
+
+    for (int trial = 0; trial < 50; trial++)
+    {
+        filter dense, sparse;
+        dense.init_dyn_share(get_f<S>, df_dx<S>, df_dw<S>, h_none<S>, 4, epsi);
+        sparse.init_dyn_share(get_f<S>, df_dx<S>, df_dw<S>, h_none<S>, 4, epsi);
+        sparse.init_sparse_propagation(df_dx_mul<S>, df_dw_cov<S>);
+
+        S s;
+        random_state(gen, s);
+        random_offset(gen, s);
+        Eigen::Matrix<double, S::DOF, S::DOF> A;
+        for (int i = 0; i < A.size(); i++) A(i) = 0.1 * u(gen);
+        typename filter::cov P = A * A.transpose() + 1e-4 * filter::cov::Identity();
+        dense.change_x(s);  dense.change_P(P);
+        sparse.change_x(s); sparse.change_P(P);
+
+        Eigen::Matrix<double, 12, 12> Q = Eigen::Matrix<double, 12, 12>::Zero();
+        for (int i = 0; i < 12; i++) Q(i, i) = 0.001 + 0.1 * std::abs(u(gen));
+
+        for (int k = 0; k < 20; k++)
+        {
+            input_ikfom in;
+            in.acc  = Eigen::Vector3d(2.0 * u(gen), 2.0 * u(gen), 9.81 + 2.0 * u(gen));
+            in.gyro = Eigen::Vector3d(u(gen), u(gen), u(gen));
+            double dt = 0.001 + 0.01 * std::abs(u(gen));
+            dense.predict(dt, Q, in);
+            sparse.predict(dt, Q, in);
+        }
+
+        const typename filter::cov &Pd = dense.get_P();
+        const typename filter::cov &Ps = sparse.get_P();
+        ASSERT_LT((Pd - Ps).cwiseAbs().maxCoeff(), 1e-9 * std::max(1.0, Pd.cwiseAbs().maxCoeff())) << "trial " << trial;
+        ASSERT_LT((dense.get_x().pos - sparse.get_x().pos).norm(), 1e-12);
+    }
+}
+
+}  // namespace
+
+TEST(SparsePropagation, MatchesDenseWithExtrinsic)
+{
+    compare_propagation<state_ikfom>(1);
+}
+
+TEST(SparsePropagation, MatchesDenseFixedExtrinsic)
+{
+    compare_propagation<state_ikfom_fixed>(2);
+}